@@ -0,0 +1,58 @@
+// Block device layer.
+//
+// bread() and bwrite() pass each disk request to bdevrw(),
+// which hands it to the driver registered for b->dev in
+// bdevsw[]. Each device has its own request queue: once the
+// driver has as many requests as it can take at once, further
+// ones wait for that device only, so a RAM disk never waits
+// behind the virtio disk.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+struct bdevsw bdevsw[NBDEV];
+
+struct {
+  struct spinlock lock;
+  int active;  // requests at the driver
+} bqueue[NBDEV];
+
+void
+bdevinit(void)
+{
+  int i;
+
+  for(i = 0; i < NBDEV; i++)
+    initlock(&bqueue[i].lock, "bqueue");
+}
+
+// Read (write == 0) or write b's block on its device.
+// Caller must hold b->lock.
+void
+bdevrw(struct buf *b, int write)
+{
+  struct bdevsw *sw;
+
+  if(b->dev >= NBDEV || bdevsw[b->dev].rw == 0)
+    panic("bdevrw: no device");
+  sw = &bdevsw[b->dev];
+
+  acquire(&bqueue[b->dev].lock);
+  while(bqueue[b->dev].active >= sw->depth)
+    sleep(&bqueue[b->dev], &bqueue[b->dev].lock);
+  bqueue[b->dev].active++;
+  release(&bqueue[b->dev].lock);
+
+  sw->rw(b, write);
+
+  acquire(&bqueue[b->dev].lock);
+  bqueue[b->dev].active--;
+  wakeup(&bqueue[b->dev]);
+  release(&bqueue[b->dev].lock);
+}
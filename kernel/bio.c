@@ -12,6 +12,12 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// The cache also holds delayed-allocation buffers: file data
+// written before the file system has picked a disk block for it.
+// These are named by (dev, inum, file block number) instead of a
+// block number, and stay pinned until fs.c gives them a disk
+// block or discards them. See bgetdelay() and bputdelay().
 
 
 #include "types.h"
@@ -23,6 +29,8 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBHASH 257
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
@@ -31,14 +39,61 @@ struct {
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  // Buffers hashed by (dev, blockno), through hnext, so that
+  // bget() need not scan all NBUF buffers.
+  struct buf *hash[NBHASH];
+
+  // Uncached buffer for bwritecopy().
+  struct buf copybuf;
+
+  int ndelay;  // delayed-allocation buffers
 } bcache;
 
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBHASH;
+}
+
+static uint
+dhash(uint dev, uint inum, uint fbn)
+{
+  return (dev * 31 + inum * 7919 + fbn) % NBHASH;
+}
+
+// Hash chain that b belongs on.
+static struct buf**
+bchain(struct buf *b)
+{
+  if(b->delay)
+    return &bcache.hash[dhash(b->dev, b->inum, b->fbn)];
+  return &bcache.hash[bhash(b->dev, b->blockno)];
+}
+
+// Remove b from its hash chain, if it is on one.
+// Caller must hold bcache.lock.
+static void
+bunhash(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = bchain(b); *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
+    }
+  }
+  b->hnext = 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  initsleeplock(&bcache.copybuf.lock, "copybuf");
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
@@ -52,6 +107,26 @@ binit(void)
   }
 }
 
+// Take the least recently used (LRU) unused buffer
+// off its hash chain, for reuse.
+// Caller must hold bcache.lock.
+static struct buf*
+brecycle(void)
+{
+  struct buf *b;
+
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0) {
+      bunhash(b);
+      b->valid = 0;
+      b->logged = 0;
+      b->delay = 0;
+      return b;
+    }
+  }
+  panic("bget: no buffers");
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -63,8 +138,8 @@ bget(uint dev, uint blockno)
   acquire(&bcache.lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  for(b = bcache.hash[bhash(dev, blockno)]; b; b = b->hnext){
+    if(!b->delay && b->dev == dev && b->blockno == blockno){
       b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
@@ -73,19 +148,88 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  b = brecycle();
+  b->dev = dev;
+  b->blockno = blockno;
+  b->refcnt = 1;
+  b->hnext = *bchain(b);
+  *bchain(b) = b;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Look up the delayed-allocation buffer for block fbn of
+// inode inum on device dev, and return it locked.
+// If there is none and alloc is set, make a zeroed one, pinned
+// until bputdelay(); if alloc is clear, or NDELAY buffers are
+// already delayed, return 0 instead.
+// The caller should hold the inode's lock.
+struct buf*
+bgetdelay(uint dev, uint inum, uint fbn, int alloc)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  for(b = bcache.hash[dhash(dev, inum, fbn)]; b; b = b->hnext){
+    if(b->delay && b->dev == dev && b->inum == inum && b->fbn == fbn){
+      b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+  if(!alloc || bcache.ndelay >= NDELAY){
+    release(&bcache.lock);
+    return 0;
+  }
+
+  b = brecycle();
+  b->delay = 1;
+  b->dev = dev;
+  b->inum = inum;
+  b->fbn = fbn;
+  b->valid = 1;
+  b->refcnt = 2;  // the caller's reference, and the pin
+  b->hnext = *bchain(b);
+  *bchain(b) = b;
+  bcache.ndelay++;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  memset(b->data, 0, BSIZE);
+  return b;
+}
+
+// Discard delayed-allocation buffer b, which the caller
+// has locked, once its data is on disk or no longer wanted.
+// The caller must still brelse(b).
+void
+bputdelay(struct buf *b)
+{
+  if(!b->delay || !holdingsleep(&b->lock))
+    panic("bputdelay");
+
+  acquire(&bcache.lock);
+  bunhash(b);
+  b->delay = 0;
+  b->dev = 0;
+  b->blockno = 0;
+  b->valid = 0;
+  b->refcnt--;  // drop the pin
+  bcache.ndelay--;
+  release(&bcache.lock);
+}
+
+// Number of delayed-allocation buffers.
+int
+bdelayed(void)
+{
+  int n;
+
+  acquire(&bcache.lock);
+  n = bcache.ndelay;
+  release(&bcache.lock);
+  return n;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,7 +240,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    bdevrw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -108,7 +252,24 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bdevrw(b, 1);
+}
+
+// Write data to block blockno on disk, bypassing the cache:
+// the cached copy of the block, if any, is left alone.
+// The log uses this to install an older version of a block
+// whose cached copy has since been changed.
+void
+bwritecopy(uint dev, uint blockno, uchar *data)
+{
+  struct buf *b = &bcache.copybuf;
+
+  acquiresleep(&b->lock);
+  b->dev = dev;
+  b->blockno = blockno;
+  memmove(b->data, data, BSIZE);
+  bdevrw(b, 1);
+  releasesleep(&b->lock);
 }
 
 // Release a locked buffer.
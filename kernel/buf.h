@@ -1,12 +1,26 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int logged;  // in the running log transaction?
+  int delay;   // delayed-allocation data, with no disk block yet?
   uint dev;
   uint blockno;
+  uint inum;   // if delay, the file's inode
+  uint fbn;    // if delay, the block's number within the file
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash chain, see bget()
   uchar data[BSIZE];
 };
 
+
+// Block device switch: maps a block device number (buf.dev)
+// to the driver that reads and writes its blocks.
+struct bdevsw {
+  void (*rw)(struct buf*, int);  // read or write a block; sleeps until done
+  int depth;                     // max requests the driver takes at once
+};
+
+extern struct bdevsw bdevsw[];
@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +51,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct waitq pollq;
 } cons;
 
 //
@@ -126,6 +129,23 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// what the console is ready for, for poll():
+// output always, input once a whole line has arrived.
+//
+int
+consolepoll(struct pollent *pe)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  pollwait(&cons.pollq, pe);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -170,6 +190,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        wqwake(&cons.pollq);
       }
     }
     break;
@@ -182,6 +203,7 @@ void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  initwaitq(&cons.pollq, "conspoll");
 
   uartinit();
 
@@ -189,4 +211,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
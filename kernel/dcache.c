@@ -0,0 +1,182 @@
+// Directory name cache.
+//
+// The dcache remembers the results of recent directory lookups:
+// which inode (and which directory offset) a name in a directory
+// refers to, or that the name is not there at all (a negative
+// entry, with inum 0). dirlookup() consults it before reading
+// the directory, so resolving a path that was resolved recently
+// needs no directory reads.
+//
+// Entries are keyed by (dev, directory inum, name) and found
+// through a hash table; when the cache is full the least
+// recently used entry is recycled.
+//
+// The directory's inode lock keeps changes of a directory's
+// entries apart from lookups in it (which may share the lock
+// with each other), so fs.c and sysfile.c must keep the cache
+// up to date while holding that lock exclusively:
+//   dirlink() enters the new name;
+//   unlink() makes the removed name a negative entry;
+//   freeing a directory inode purges all of its entries.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dir;             // directory inode number
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in dir
+  uint off;             // offset of name's dirent in dir
+  int used;
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Remove d from its hash chain.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->hnext = 0;
+  d->used = 0;
+}
+
+// Move d to the front of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dir, name)]; d; d = d->hnext){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+// Look up name in directory dir on device dev.
+// Returns 1 and sets *inum (0 if the name is known not to
+// exist) and *off if the answer is cached, else returns 0.
+int
+dcachelookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dtouch(d);
+  *inum = d->inum;
+  *off = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dir is inode inum, with its
+// dirent at offset off, or that it is absent if inum is 0.
+void
+dcacheenter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->used)
+      dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    d->used = 1;
+    d->hnext = dcache.hash[dhash(dev, dir, name)];
+    dcache.hash[dhash(dev, dir, name)] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget all entries for directory dir, which is being freed.
+void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    if(d->used && d->dev == dev && d->dir == dir)
+      dunhash(d);
+  }
+  release(&dcache.lock);
+}
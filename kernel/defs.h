@@ -1,13 +1,27 @@
 struct buf;
 struct context;
+struct dirent;
+struct diriter;
 struct file;
+struct iovec;
 struct inode;
+struct lockinfo;
+struct logstat;
 struct pipe;
+struct pollent;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct rwlock;
+struct rwsleeplock;
 struct stat;
 struct superblock;
+struct uio;
+struct waitq;
+
+// bdev.c
+void            bdevinit(void);
+void            bdevrw(struct buf*, int);
 
 // bio.c
 void            binit(void);
@@ -16,6 +30,16 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bwritecopy(uint, uint, uchar*);
+struct buf*     bgetdelay(uint, uint, uint, int);
+void            bputdelay(struct buf*);
+int             bdelayed(void);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(uint, uint, char*, uint*, uint*);
+void            dcacheenter(uint, uint, char*, uint, uint);
+void            dcachepurge(uint, uint);
 
 // console.c
 void            consoleinit(void);
@@ -31,50 +55,82 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadu(struct file*, struct uio*, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filewriteu(struct file*, struct uio*, int);
+int             filesync(struct file*);
+int             filepoll(struct file*, struct pollent*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirstart(struct diriter*, struct inode*);
+struct dirent*  dirnext(struct diriter*);
+void            dirend(struct diriter*);
+int             isdirempty(struct inode*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iflush(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            iunlockshared(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+int             mount(struct inode*, uint);
+int             umount(struct inode*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readiu(struct inode*, struct uio*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeiu(struct inode*, struct uio*, uint, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskrw(struct buf*, int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kdup(void *);
 void            kinit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+int             log_capacity(void);
+void            log_stat(struct logstat*);
+void            log_force(void);
+int             log_setmode(int);
 
 // pipe.c
-int             pipealloc(struct file**, struct file**);
+int             pipealloc(struct file**, struct file**, int);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, struct pollent*);
+
+// poll.c
+void            initwaitq(struct waitq*, char*);
+void            pollwait(struct waitq*, struct pollent*);
+void            wqwake(struct waitq*);
+int             poll(uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,11 +141,15 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+uint64          growproc(int);
+int             clone(uint64, uint64, uint64, uint64);
+int             join(uint64);
+int             threaded(struct proc*);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             kthread(char*, void (*)(void));
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -107,6 +167,8 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            pollsleep(int);
+void            wakepoll(struct proc*);
 void            update_time(void);
 int             set_priority(int new_priority, int pid);
 
@@ -119,12 +181,36 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockclass(char*, int);
+void            lockcount(int, int, uint64);
+void            lockhold(int, uint64);
+int             lockinfo(int, struct lockinfo*);
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
+// shm.c
+void            shminit(void);
+int             shmcreate(char*, int);
+uint64          shmattach(int);
+int             shmdetach(uint64);
+int             shmremove(char*);
+int             shmfork(struct proc*, struct proc*);
+void            shmexit(struct proc*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquirereadsleep(struct rwsleeplock*);
+void            releasereadsleep(struct rwsleeplock*);
+void            acquirewritesleep(struct rwsleeplock*);
+void            releasewritesleep(struct rwsleeplock*);
+int             holdingwritesleep(struct rwsleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -150,6 +236,16 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// tmpfs.c
+void            tmpinit(void);
+uint            tmpialloc(short);
+void            tmpiload(struct inode*);
+void            tmpiupdate(struct inode*);
+void            tmpitrunc(struct inode*);
+int             tmpread(struct inode*, struct uio*, uint, uint);
+int             tmpwrite(struct inode*, struct uio*, uint, uint);
+struct dirent*  tmpdirent(struct inode*, uint);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -174,6 +270,8 @@ pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
+void            uioinit(struct uio*, struct iovec*, int, pagetable_t);
+int             uiomove(void*, uint64, int, struct uio*);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
 // plic.c
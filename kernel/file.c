@@ -12,6 +12,9 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "iovec.h"
+#include "uio.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -76,9 +79,15 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
-    iput(ff.ip);
-    end_op();
+    if(ff.type == FD_INODE && ff.writable)
+      iflush(ff.ip);
+    if(ff.ip->dev == TMPDEV){
+      iput(ff.ip);  // tmpfs has no log
+    } else {
+      begin_op();
+      iput(ff.ip);
+      end_op();
+    }
   }
 }
 
@@ -91,9 +100,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -101,27 +110,106 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Make the data written to file f durable: write out its
+// delayed blocks and commit the log.
+int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE && f->type != FD_DEVICE)
+    return -1;
+  if(f->ip->dev == TMPDEV)
+    return 0;  // nothing to make durable
+  if(f->type == FD_INODE)
+    iflush(f->ip);
+  log_force();
+  return 0;
+}
+
+// Return the POLL bits for what f is ready for, and put
+// pe on f's wait queue if it has one.
+int
+filepoll(struct file *f, struct pollent *pe)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, pe);
+  else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+          devsw[f->major].poll)
+    r = devsw[f->major].poll(pe);
+  else
+    r = POLLIN | POLLOUT;
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+  struct uio uio;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, myproc()->pagetable);
+  return filereadu(f, &uio, -1);
+}
+
+// Read from file f into uio's buffers, which are in
+// the current process's user memory.
+// If off is -1, read at the file offset and advance it;
+// otherwise read at off and leave the file offset alone,
+// which only makes sense for inodes.
+int
+filereadu(struct file *f, struct uio *uio, int off)
+{
+  struct iovec *iov;
+  int r = 0, m;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].read))
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    // one buffer at a time, stopping at a short read.
+    for(; uio->iovcnt > 0; uio->iov++, uio->iovcnt--){
+      iov = uio->iov;
+      if(iov->iov_len == 0)
+        continue;
+      if(f->type == FD_PIPE)
+        m = piperead(f->pipe, (uint64)iov->iov_base, iov->iov_len, f->nonblock);
+      else
+        m = devsw[f->major].read(1, (uint64)iov->iov_base, iov->iov_len);
+      if(m < 0)
+        return r > 0 ? r : -1;
+      r += m;
+      if(m < iov->iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    if(off >= 0){
+      // pread leaves f->off alone, so readers can share the inode.
+      ilockshared(f->ip);
+      r = readiu(f->ip, uio, off, uio->resid);
+      iunlockshared(f->ip);
+    } else {
+      // the inode lock also serializes reads of f->off.
+      ilock(f->ip);
+      if((r = readiu(f->ip, uio, f->off, uio->resid)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+    }
   } else {
     panic("fileread");
   }
@@ -129,45 +217,101 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Log blocks a transaction writing nd blocks of file data
+// may dirty: the data blocks themselves, one more for a
+// non-aligned start, the indirect blocks mapping them
+// (one per NINDIRECT, plus the double-indirect block and
+// one for a chunk that straddles two indirect blocks), the
+// bitmap blocks, and the i-node.
+static int
+wtxblocks(int nd)
+{
+  return nd + 1 + (nd / NINDIRECT + 3) + (nd / BPB + 2) + 1;
+}
+
+// Most data blocks one transaction of nblocks can write.
+static int
+wtxmax(int nblocks)
+{
+  int nd;
+
+  for(nd = nblocks; nd > 1 && wtxblocks(nd) > nblocks; nd--)
+    ;
+  return nd;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
+  struct iovec iov;
+  struct uio uio;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, myproc()->pagetable);
+  return filewriteu(f, &uio, -1);
+}
+
+// Write uio's buffers, which are in the current process's
+// user memory, to file f. off is as for filereadu().
+int
+filewriteu(struct file *f, struct uio *uio, int off)
+{
+  struct iovec *iov;
   int r, ret = 0;
 
   if(f->writable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    for(; uio->iovcnt > 0; uio->iov++, uio->iovcnt--){
+      iov = uio->iov;
+      if(iov->iov_len == 0)
+        continue;
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, (uint64)iov->iov_base, iov->iov_len, f->nonblock);
+      else
+        r = devsw[f->major].write(1, (uint64)iov->iov_base, iov->iov_len);
+      if(r < 0)
+        return ret > 0 ? ret : -1;
+      ret += r;
+      if(r < iov->iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // write as many blocks per transaction as half the
+    // log holds, leaving the other half for concurrent
+    // operations, so that most writes are one transaction.
+    // tmpfs has no log, so writes there need no transaction.
+    int tmp = f->ip->dev == TMPDEV;
+    int max = (wtxmax(log_capacity() / 2) - 1) * BSIZE;
+    int n = uio->resid;
     int i = 0;
     while(i < n){
       int n1 = n - i;
-      if(n1 > max)
+      if(n1 > max && !tmp)
         n1 = max;
 
-      begin_op();
+      if(!tmp)
+        begin_opn(wtxblocks(n1 / BSIZE + 1));
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writeiu(f->ip, uio, off < 0 ? f->off : off + i, n1)) > 0 && off < 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      if(!tmp)
+        end_op();
 
       if(r != n1){
-        // error from writei
+        // error from writeiu
         break;
       }
       i += r;
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -13,12 +14,22 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+// A run of file blocks stored in consecutive disk blocks.
+struct extent {
+  uint fbn;           // first file block
+  uint bno;           // its disk block
+  uint len;           // number of blocks, 0 if unused
+};
+
+#define NEXTENT 4     // cached extents per inode
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  int mounted;        // covered by a mount, or a mounted root (see fs.c)
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
@@ -26,13 +37,48 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  union {
+    uint addrs[NDIRECT+2];
+    uchar data[NINLINE];
+  };
+
+  int ndelay;         // delayed-allocation blocks (see fs.c)
+  uint dlo, dhi;      // they lie in [dlo, dhi)
+  uint dmeta;         // blocks reserved for their indirect blocks
+
+  struct spinlock extlock;     // protects ext[] and extnext
+  struct extent ext[NEXTENT];  // indirect block mappings (see bmap)
+  int extnext;        // next ext[] entry to replace
+  uint lastalloc;     // last block allocated for the file, or 0
+  int dirfmt;         // T_DIR: linear or hashed, if known (see fs.c)
+
+  struct inode *hnext;   // inode table hash chain
+  struct inode *prev;    // inode table LRU list, if ref is 0
+  struct inode *next;
+};
+
+// directory iterator (see fs.c)
+struct diriter {
+  struct inode *dp;
+  struct buf *bp;     // buffer of the current block, if any
+  uint off;           // offset of the next entry
+  uint cur;           // offset of the entry dirnext() returned
 };
 
 // map major device number to device functions.
+struct pollent;
+
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);  // or 0 if always ready
+};
+
+// The processes poll()ing a file, see poll.c.
+struct waitq {
+  struct spinlock lock;
+  struct pollent *head;
 };
 
 extern struct devsw devsw[];
@@ -20,11 +20,55 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "iovec.h"
+#include "uio.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+
+#define FLUSHBATCH  64  // delayed blocks written out per transaction
+#define MAXBMAP     32  // max bitmap blocks
+
+// ip->dirfmt values.
+#define DIR_UNKNOWN 0
+#define DIR_LINEAR  1
+#define DIR_HASHED  2
+// One superblock per block device, valid once it is mounted.
+struct superblock sb[NBDEV];
+
+// Free block counts for each mounted device, kept in step
+// with its bitmap.
+// Delayed allocation reserves blocks here for file data that
+// has no disk block yet, so that the data can always be
+// written out later; ordinary allocations may not use them.
+// balloc() skips bitmap blocks whose nfreebm[] count is 0.
+struct {
+  struct spinlock lock;
+  uint nfree;   // free blocks
+  uint nresv;   // of which reserved for delayed-allocation data
+  uint cursor;  // where allocations with no goal start looking
+  ushort nfreebm[MAXBMAP];  // free blocks per bitmap block
+} freemap[NBDEV];
+
+// Mount table.
+//
+// Each entry covers directory ip with the root directory of the
+// file system on device dev. namex() crosses from ip to root on
+// the way down, and back from root to ip to look up "..".
+// Both inodes are marked mounted, so that namex() only consults
+// the table for them.
+struct mount {
+  uint dev;
+  int used;
+  struct inode *ip;    // covered directory, once mounted
+  struct inode *root;  // root of dev's file system
+};
+
+struct {
+  struct spinlock lock;
+  struct mount m[NMOUNT];
+} mtable;
+
+static void flusher(void);
 
 // Read the super block.
 static void
@@ -37,13 +81,58 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Count the free blocks in the bitmap.
+static void
+initfreemap(int dev)
+{
+  int b, bi;
+  struct buf *bp;
+
+  initlock(&freemap[dev].lock, "freemap");
+  freemap[dev].nfree = 0;
+  freemap[dev].nresv = 0;
+  memset(freemap[dev].nfreebm, 0, sizeof(freemap[dev].nfreebm));
+  if((sb[dev].size + BPB - 1) / BPB > MAXBMAP)
+    panic("initfreemap: disk too big");
+  for(b = 0; b < sb[dev].size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb[dev]));
+    for(bi = 0; bi < BPB && b + bi < sb[dev].size; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        freemap[dev].nfreebm[b / BPB]++;
+    }
+    freemap[dev].nfree += freemap[dev].nfreebm[b / BPB];
+    brelse(bp);
+  }
+  freemap[dev].cursor = sb[dev].size - sb[dev].nblocks;
+}
+
 // Init fs
 void
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC)
     panic("invalid file system");
-  initlog(dev, &sb);
+  initlog(dev, &sb[dev]);
+  initfreemap(dev);
+  if(kthread("flusher", flusher) < 0)
+    panic("fsinit: flusher");
+}
+
+// Get ready to mount the file system on device dev.
+// Only the root device has a log, so the file system must
+// have none: each of its writes goes straight to the device.
+// Returns 0 on success, -1 if dev holds no such file system.
+static int
+fsmount(uint dev)
+{
+  if(dev == TMPDEV)
+    return 0;  // tmpfs needs no setting up
+  readsb(dev, &sb[dev]);
+  if(sb[dev].magic != FSMAGIC || sb[dev].nlog != 0 ||
+     (sb[dev].size + BPB - 1) / BPB > MAXBMAP)
+    return -1;
+  initfreemap(dev);
+  return 0;
 }
 
 // Zero a block.
@@ -60,31 +149,83 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Find a free block at or after goal, wrapping around to
+// the start of the disk, and mark it in use.
+// The caller must have taken the block off freemap[dev].nfree.
 static uint
-balloc(uint dev)
+bfind(uint dev, uint goal)
 {
-  int b, bi, m;
+  int i, n, bm, bi, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  n = (sb[dev].size + BPB - 1) / BPB;
+  for(i = 0; i <= n; i++){
+    // The goal's bitmap block comes first and last, so
+    // that the blocks before the goal are searched too.
+    bm = (goal / BPB + i) % n;
+    if(freemap[dev].nfreebm[bm] == 0)  // racy, but only a hint
+      continue;
+    bp = bread(dev, sb[dev].bmapstart + bm);
+    bi = i == 0 ? goal % BPB : 0;
+    while(bi < BPB && bm * BPB + bi < sb[dev].size){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        bi += 8;  // skip a byte of allocated blocks
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        acquire(&freemap[dev].lock);
+        freemap[dev].nfreebm[bm]--;
+        release(&freemap[dev].lock);
+        return bm * BPB + bi;
       }
+      bi++;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
-  return 0;
+  panic("balloc: freemap");
+}
+
+// Allocate a zeroed disk block, at goal or as soon after it
+// as possible. If goal is 0, carry on from the last block
+// allocated that way, so that new files are laid out one
+// after another instead of in the first holes on the disk.
+// If resv is set, use a block reserved by breserve().
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal, int resv)
+{
+  uint b;
+
+  acquire(&freemap[dev].lock);
+  if(resv){
+    if(freemap[dev].nresv == 0)
+      panic("balloc: no reservation");
+    freemap[dev].nresv--;
+  } else if(freemap[dev].nfree <= freemap[dev].nresv){
+    release(&freemap[dev].lock);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  freemap[dev].nfree--;
+  release(&freemap[dev].lock);
+
+  if(goal != 0 && goal < sb[dev].size){
+    b = bfind(dev, goal);
+  } else {
+    acquire(&freemap[dev].lock);
+    goal = freemap[dev].cursor;
+    release(&freemap[dev].lock);
+    b = bfind(dev, goal);
+    acquire(&freemap[dev].lock);
+    freemap[dev].cursor = b + 1 < sb[dev].size ? b + 1 : sb[dev].size - sb[dev].nblocks;
+    release(&freemap[dev].lock);
+  }
+  bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -94,7 +235,7 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(dev, BBLOCK(b, sb[dev]));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -102,6 +243,38 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&freemap[dev].lock);
+  freemap[dev].nfree++;
+  freemap[dev].nfreebm[b / BPB]++;
+  release(&freemap[dev].lock);
+}
+
+// Reserve n free blocks for delayed-allocation data and
+// the indirect blocks needed to write it out.
+// Returns 0, reserving none, if the disk is too full.
+static int
+breserve(uint dev, uint n)
+{
+  int ok;
+
+  acquire(&freemap[dev].lock);
+  ok = freemap[dev].nfree - freemap[dev].nresv >= n;
+  if(ok)
+    freemap[dev].nresv += n;
+  release(&freemap[dev].lock);
+  return ok;
+}
+
+// Give back n reservations that will not be used.
+static void
+bunreserve(uint dev, uint n)
+{
+  acquire(&freemap[dev].lock);
+  if(freemap[dev].nresv < n)
+    panic("bunreserve");
+  freemap[dev].nresv -= n;
+  release(&freemap[dev].lock);
 }
 
 // Inodes.
@@ -134,7 +307,9 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry keeps its inode, so that
+//   iget() can find it again without reading the disk,
+//   until iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -144,7 +319,10 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. Code that only examines
+//   them may lock the inode shared, with ilockshared(), so
+//   that, say, every path lookup through the root directory
+//   need not wait for the others.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -167,29 +345,112 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash and LRU links.
 //
-// An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
-// read or write that inode's ip->valid, ip->size, ip->type, &c.
+// An ip->lock reader-writer sleep-lock protects all ip-> fields
+// other than ref, dev, and inum.  One must hold ip->lock in order
+// to read that inode's ip->valid, ip->size, ip->type, &c, and hold
+// it exclusively to write them. The exceptions are caches that
+// readers fill in: ip->extlock protects the extent cache, and
+// readers only set ip->dirfmt from DIR_UNKNOWN to its value.
+
+// The table starts empty and grows a page of entries at a
+// time, up to NINODE entries; entries are never freed.
+// Entries are found through a hash table on (dev, inum).
+// Free entries are also on an LRU list, and iget() recycles
+// the least recently used one once the table is full.
+
+#define NIHASH   61
+#define IPERPAGE (PGSIZE / sizeof(struct inode))
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *page[(NINODE + IPERPAGE - 1) / IPERPAGE];
+  int ninode;
+
+  // Free entries, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&mtable.lock, "mtable");
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
+}
+
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
+}
+
+// Put ip on the free list, at the front if it holds an
+// inode worth keeping, else at the back.
+// Caller must hold itable.lock.
+static void
+ilruput(struct inode *ip, int front)
+{
+  if(front){
+    ip->next = itable.lru.next;
+    ip->prev = &itable.lru;
+  } else {
+    ip->next = &itable.lru;
+    ip->prev = itable.lru.prev;
   }
+  ip->next->prev = ip;
+  ip->prev->next = ip;
+}
+
+// Caller must hold itable.lock.
+static void
+ilrudel(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  ip->next = ip->prev = 0;
+}
+
+// Add a page of free entries to the table.
+// Returns 0 if the table is full or out of memory.
+// Caller must hold itable.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  int i;
+
+  if(itable.ninode + IPERPAGE > NINODE)
+    return 0;
+  if((ip = (struct inode*)kalloc()) == 0)
+    return 0;
+  memset(ip, 0, PGSIZE);
+  itable.page[itable.ninode / IPERPAGE] = ip;
+  itable.ninode += IPERPAGE;
+  for(i = 0; i < IPERPAGE; i++){
+    initrwsleeplock(&ip[i].lock, "inode");
+    initlock(&ip[i].extlock, "extent");
+    ilruput(&ip[i], 0);
+  }
+  return 1;
+}
+
+// Table entry i, for i < itable.ninode.
+static struct inode*
+inodeat(int i)
+{
+  return &itable.page[i / IPERPAGE][i % IPERPAGE];
 }
 
 static struct inode* iget(uint dev, uint inum);
+static int iempty(struct inode*);
+static int ispill(struct inode*);
+static uint wblocks(struct inode*, struct uio*, uint, uint);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -202,8 +463,14 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  if(dev == TMPDEV){
+    if((inum = tmpialloc(type)) == 0)
+      return 0;
+    return iget(dev, inum);
+  }
+
+  for(inum = 1; inum < sb[dev].ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb[dev]));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
@@ -228,14 +495,25 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->dev == TMPDEV){
+    tmpiupdate(ip);
+    return;
+  }
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  // Blocks from ip->dlo on may have no disk block yet;
+  // don't let the on-disk size cover them.
+  if(ip->ndelay > 0)
+    dip->size = min(ip->size, ip->dlo * BSIZE);
+  else
+    dip->size = ip->size;
+  dip->flags = ip->flags;
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
 }
@@ -246,31 +524,49 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[ihash(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilrudel(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry,
+  // after growing the table if it can still grow.
+  ip = itable.lru.prev;
+  if(ip == &itable.lru || ip->inum != 0){
+    if(igrow())
+      ip = itable.lru.prev;
+  }
+  for(; ip != &itable.lru; ip = ip->prev){
+    if(ip->ndelay == 0)
+      break;
+  }
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  ilrudel(ip);
 
-  ip = empty;
+  if(ip->inum != 0){
+    for(pp = &itable.hash[ihash(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+      if(*pp == ip){
+        *pp = ip->hnext;
+        break;
+      }
+    }
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[ihash(dev, inum)];
+  itable.hash[ihash(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -298,32 +594,72 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewritesleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    if(ip->dev == TMPDEV){
+      tmpiload(ip);
+    } else {
+      bp = bread(ip->dev, IBLOCK(ip->inum, sb[ip->dev]));
+      dip = (struct dinode*)bp->data + ip->inum%IPB;
+      ip->type = dip->type;
+      ip->major = dip->major;
+      ip->minor = dip->minor;
+      ip->nlink = dip->nlink;
+      ip->size = dip->size;
+      ip->flags = dip->flags;
+      memmove(ip->data, dip->data, sizeof(ip->data));
+      brelse(bp);
+    }
+    memset(ip->ext, 0, sizeof(ip->ext));
+    ip->lastalloc = 0;
+    ip->dirfmt = DIR_UNKNOWN;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Lock the given inode shared, for reading only.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquirereadsleep(&ip->lock);
+  if(ip->valid == 0){
+    // Loading the inode changes it, so lock it exclusively.
+    // It stays valid while we hold a reference.
+    releasereadsleep(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquirereadsleep(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwritesleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewritesleep(&ip->lock);
+}
+
+// Unlock an inode locked with ilockshared().
+// Readers are not recorded, so unlike iunlock() this cannot
+// check that the caller is one of them; releasereadsleep()
+// only checks that someone is.
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasereadsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -336,29 +672,46 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  int op = 0;
+
   acquire(&itable.lock);
 
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0 && ip->dev != TMPDEV &&
+     myproc()->logres == 0){
+    // freeing it writes to the log, and the caller, say a
+    // tmpfs call looking up a path, is not in a transaction.
+    release(&itable.lock);
+    begin_op();
+    op = 1;
+    acquire(&itable.lock);
+  }
+
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
     // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
-    acquiresleep(&ip->lock);
+    // so this acquirewritesleep() won't block (or deadlock).
+    acquirewritesleep(&ip->lock);
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
-    releasesleep(&ip->lock);
+    releasewritesleep(&ip->lock);
 
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilruput(ip, ip->valid);
   release(&itable.lock);
+  if(op)
+    end_op();
 }
 
 // Common idiom: unlock, then put.
@@ -374,61 +727,444 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in indirect blocks, which are listed in
+// the double-indirect block ip->addrs[NDIRECT+1].
+//
+// To save reading indirect blocks, ip->ext[] caches a few runs
+// of file blocks that are stored in consecutive disk blocks.
+// Sequentially written files are mostly long runs, so a few
+// extents map most of a file. Blocks are never moved, so the
+// cache only has to be cleared when the file is truncated.
+
+// bmap() alloc modes.
+#define BMAP_LOOKUP   0  // don't allocate
+#define BMAP_ALLOC    1  // allocate missing blocks
+#define BMAP_RESERVED 2  // as BMAP_ALLOC, but the data block was reserved
+
+// Look up file block bn in ip's extent cache.
+// Returns 0 if it is not there.
+static uint
+extlookup(struct inode *ip, uint bn)
+{
+  struct extent *e;
+  uint addr;
+
+  addr = 0;
+  acquire(&ip->extlock);
+  for(e = ip->ext; e < &ip->ext[NEXTENT]; e++){
+    if(e->len > 0 && bn >= e->fbn && bn < e->fbn + e->len){
+      addr = e->bno + (bn - e->fbn);
+      break;
+    }
+  }
+  release(&ip->extlock);
+  return addr;
+}
+
+// Cache the run around entry i of indirect block a[],
+// which holds file block bn.
+static void
+extinsert(struct inode *ip, uint bn, uint *a, int i)
+{
+  int lo, hi;
+  uint fbn;
+  struct extent *e, *victim;
+
+  for(lo = i; lo > 0 && a[lo-1] != 0 && a[lo-1] + 1 == a[lo]; lo--)
+    ;
+  for(hi = i; hi + 1 < NINDIRECT && a[hi+1] != 0 && a[hi+1] == a[hi] + 1; hi++)
+    ;
+  fbn = bn - (i - lo);
+
+  // Replace an extent this run overlaps (it has grown),
+  // else the entries in turn.
+  acquire(&ip->extlock);
+  victim = 0;
+  for(e = ip->ext; e < &ip->ext[NEXTENT]; e++){
+    if(e->len > 0 && e->fbn < fbn + (hi - lo + 1) && fbn < e->fbn + e->len){
+      victim = e;
+      break;
+    }
+  }
+  if(victim == 0){
+    victim = &ip->ext[ip->extnext];
+    ip->extnext = (ip->extnext + 1) % NEXTENT;
+  }
+  victim->fbn = fbn;
+  victim->bno = a[lo];
+  victim->len = hi - lo + 1;
+  release(&ip->extlock);
+}
+
+// Allocate a block for ip near goal, or if goal is 0, just
+// after the last block allocated for it.
+static uint
+iballoc(struct inode *ip, uint goal, int resv)
+{
+  uint addr;
+
+  if(goal == 0 && ip->lastalloc != 0)
+    goal = ip->lastalloc + 1;
+  if((addr = balloc(ip->dev, goal, resv)) != 0)
+    ip->lastalloc = addr;
+  return addr;
+}
+
+// Should bmap() take a missing indirect block from ip's
+// reservation (ip->dmeta)? Only when writing out delayed
+// blocks, whose indirect blocks idelay() reserved.
+static int
+imetaresv(struct inode *ip, int alloc)
+{
+  if(alloc != BMAP_RESERVED || ip->dmeta == 0)
+    return 0;
+  ip->dmeta--;
+  return 1;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block and alloc is BMAP_LOOKUP, return 0;
+// otherwise bmap allocates one.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int alloc)
 {
-  uint addr, *a;
+  uint addr, fbn, *a;
+  int level, i;
   struct buf *bp;
 
+  if(ip->flags & DI_INLINE)
+    panic("bmap: inline");
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      if(alloc == BMAP_LOOKUP)
+        return 0;
+      addr = iballoc(ip, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0,
+                     alloc == BMAP_RESERVED);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
     return addr;
   }
-  bn -= NDIRECT;
 
+  if((addr = extlookup(ip, bn)) != 0)
+    return addr;
+
+  fbn = bn;
+  bn -= NDIRECT;
   if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+    i = NDIRECT;
+    level = 1;
+  } else if((bn -= NINDIRECT) < NDINDIRECT){
+    i = NDIRECT+1;
+    level = 2;
+  } else
+    panic("bmap: out of range");
+
+  // Load the top indirect block, allocating if necessary.
+  if((addr = ip->addrs[i]) == 0){
+    if(alloc == BMAP_LOOKUP)
+      return 0;
+    addr = iballoc(ip, 0, imetaresv(ip, alloc));
+    if(addr == 0)
+      return 0;
+    ip->addrs[i] = addr;
+  }
+
+  // Walk down to the data block.
+  for(; level > 0; level--){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    i = level == 2 ? bn / NINDIRECT : bn % NINDIRECT;
+    if((addr = a[i]) == 0 && alloc != BMAP_LOOKUP){
+      // Put a data block just after the one before it.
+      addr = iballoc(ip, level == 1 && i > 0 && a[i-1] ? a[i-1] + 1 : 0,
+                     level == 1 ? alloc == BMAP_RESERVED : imetaresv(ip, alloc));
       if(addr){
-        a[bn] = addr;
+        a[i] = addr;
         log_write(bp);
       }
     }
+    if(level == 1 && addr != 0)
+      extinsert(ip, fbn, a, i);
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
   }
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Delayed allocation
+//
+// writei() does not give a new block of a regular file a disk
+// block right away. The data goes in a delayed-allocation
+// buffer in the cache (see bgetdelay()), and a free block is
+// reserved for it. iflush() later allocates all of a file's
+// delayed blocks together, so that repeated writes to the
+// block cost one log write and one allocation, and the blocks
+// of a file written sequentially are allocated in a run.
+//
+// ip->ndelay counts ip's delayed blocks, which all lie in
+// [ip->dlo, ip->dhi); every block below ip->dlo has a disk
+// block. iflush() runs when the last file descriptor for the
+// inode is closed, and the flusher thread writes out delayed
+// blocks of files that stay open.
+//
+// Writing a delayed block out may also need indirect blocks,
+// so ip->dmeta blocks are reserved for those too: at least
+// as many as are missing for [ip->dlo, ip->dhi). iflush()
+// therefore never runs out of disk space; when there is not
+// enough to reserve, writei() allocates blocks right away.
+
+// The number of indirect blocks missing for file blocks
+// [lo, hi) of ip.
+// Caller must hold ip->lock.
+static uint
+imetaneed(struct inode *ip, uint lo, uint hi)
+{
+  uint n, k, klo, khi, *a;
+  struct buf *bp;
+
+  n = 0;
+  if(lo < NDIRECT + NINDIRECT && hi > NDIRECT && ip->addrs[NDIRECT] == 0)
+    n++;
+  if(hi <= NDIRECT + NINDIRECT)
+    return n;
+
+  // The double-indirect block, and one indirect block
+  // for each NINDIRECT blocks under it.
+  klo = lo > NDIRECT + NINDIRECT ? (lo - NDIRECT - NINDIRECT) / NINDIRECT : 0;
+  khi = (hi - 1 - NDIRECT - NINDIRECT) / NINDIRECT;
+  if(ip->addrs[NDIRECT+1] == 0)
+    return n + 1 + (khi - klo + 1);
+  bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+  a = (uint*)bp->data;
+  for(k = klo; k <= khi; k++){
+    if(a[k] == 0)
+      n++;
+  }
+  brelse(bp);
+  return n;
 }
 
-// Truncate inode (discard contents).
+// Give back ip's indirect block reservations, once it
+// has no delayed blocks.
+static void
+iunreservemeta(struct inode *ip)
+{
+  if(ip->dmeta > 0){
+    bunreserve(ip->dev, ip->dmeta);
+    ip->dmeta = 0;
+  }
+}
+
+// Return the delayed-allocation buffer for block bn of ip,
+// locked, making one if bn is a new block of a regular file.
+// Returns 0 if bn should be allocated now instead.
 // Caller must hold ip->lock.
+static struct buf*
+idelay(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+
+  uint lo, hi, need, more;
+
+  if(ip->ndelay > 0 && (bp = bgetdelay(ip->dev, ip->inum, bn, 0)) != 0)
+    return bp;
+  if(ip->type != T_FILE)
+    return 0;
+
+  // Reserve the data block, and any indirect blocks the
+  // wider range of delayed blocks may need.
+  more = 0;
+  if(ip->ndelay == 0 || bn < ip->dlo || bn >= ip->dhi){
+    lo = ip->ndelay == 0 || bn < ip->dlo ? bn : ip->dlo;
+    hi = ip->ndelay == 0 || bn >= ip->dhi ? bn + 1 : ip->dhi;
+    need = imetaneed(ip, lo, hi);
+    if(need > ip->dmeta)
+      more = need - ip->dmeta;
+  }
+  if(!breserve(ip->dev, 1 + more))
+    return 0;
+  if((bp = bgetdelay(ip->dev, ip->inum, bn, 1)) == 0){
+    bunreserve(ip->dev, 1 + more);
+    return 0;
+  }
+  ip->dmeta += more;
+
+  if(ip->ndelay == 0){
+    ip->dlo = bn;
+    ip->dhi = bn + 1;
+  } else if(bn < ip->dlo){
+    ip->dlo = bn;
+  } else if(bn >= ip->dhi){
+    ip->dhi = bn + 1;
+  }
+  ip->ndelay++;
+  return bp;
+}
+
+// Discard ip's delayed blocks.
+// Caller must hold ip->lock.
+static void
+idiscard(struct inode *ip)
+{
+  uint bn;
+  struct buf *bp;
+
+  for(bn = ip->dlo; ip->ndelay > 0 && bn < ip->dhi; bn++){
+    if((bp = bgetdelay(ip->dev, ip->inum, bn, 0)) == 0)
+      continue;
+    bputdelay(bp);
+    brelse(bp);
+    bunreserve(ip->dev, 1);
+    ip->ndelay--;
+  }
+  if(ip->ndelay != 0)
+    panic("idiscard");
+  iunreservemeta(ip);
+}
+
+// Allocate disk blocks for ip's delayed blocks and write them
+// through the log, FLUSHBATCH blocks per transaction.
+// Caller must not hold ip->lock or be in a transaction.
 void
-itrunc(struct inode *ip)
+iflush(struct inode *ip)
+{
+  int n;
+  uint addr;
+  struct buf *bp, *dbp;
+
+  if(ip->ndelay == 0)  // racy, but only an early out
+    return;
+
+  for(;;){
+    // The batch needs its data blocks, plus bitmap blocks,
+    // the indirect block and the inode.
+    begin_opn(FLUSHBATCH + 8);
+    ilock(ip);
+    if(ip->ndelay == 0){
+      iunlock(ip);
+      end_op();
+      return;
+    }
+    for(n = 0; n < FLUSHBATCH && ip->ndelay > 0; ip->dlo++){
+      if((dbp = bgetdelay(ip->dev, ip->inum, ip->dlo, 0)) == 0)
+        continue;
+      // the data and indirect blocks are all reserved.
+      if((addr = bmap(ip, ip->dlo, BMAP_RESERVED)) == 0)
+        panic("iflush: bmap");
+      bp = bread(ip->dev, addr);
+      memmove(bp->data, dbp->data, BSIZE);
+      log_write(bp);
+      brelse(bp);
+      bputdelay(dbp);
+      brelse(dbp);
+      ip->ndelay--;
+      n++;
+    }
+    if(ip->ndelay == 0)
+      iunreservemeta(ip);
+    iupdate(ip);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Kernel thread that writes out the delayed blocks of open
+// files every FLUSHTICKS ticks, or at the next tick once
+// half of the NDELAY buffers are in use.
+static void
+flusher(void)
+{
+  int i;
+  uint t0;
+  struct inode *ip;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS){
+      if(bdelayed() >= NDELAY/2)
+        break;
+      sleep(&ticks, &tickslock);
+    }
+    release(&tickslock);
+
+    for(i = 0; ; i++){
+      acquire(&itable.lock);
+      if(i >= itable.ninode){
+        release(&itable.lock);
+        break;
+      }
+      ip = inodeat(i);
+      if(ip->ref == 0 || ip->ndelay == 0){
+        release(&itable.lock);
+        continue;
+      }
+      ip->ref++;
+      release(&itable.lock);
+
+      iflush(ip);
+      begin_op();
+      iput(ip);
+      end_op();
+    }
+  }
+}
+
+// Free indirect block addr and the blocks it lists.
+// Level 1 blocks list data blocks; level 2 blocks
+// list level 1 blocks.
+static void
+bfreeind(uint dev, uint addr, int level)
 {
-  int i, j;
+  int j;
   struct buf *bp;
   uint *a;
 
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      bfreeind(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  int i;
+
+  if(ip->dev == TMPDEV){
+    tmpitrunc(ip);
+    ip->dirfmt = DIR_UNKNOWN;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->flags & DI_INLINE){
+    memset(ip->data, 0, sizeof(ip->data));
+    ip->flags &= ~DI_INLINE;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->ndelay > 0)
+    idiscard(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -436,24 +1172,22 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NDIRECT+2; i++){
+    if(ip->addrs[i]){
+      bfreeind(ip->dev, ip->addrs[i], i - NDIRECT + 1);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  memset(ip->ext, 0, sizeof(ip->ext));
+  ip->lastalloc = 0;
+  ip->dirfmt = DIR_UNKNOWN;
 
   ip->size = 0;
   iupdate(ip);
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -465,27 +1199,53 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct iovec iov;
+  struct uio uio;
+
+  iov.iov_base = (void*)dst;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, user_dst ? myproc()->pagetable : 0);
+  return readiu(ip, &uio, off, n);
+}
+
+// Read up to n bytes from inode into uio's buffers.
+// n must not exceed uio->resid.
+// Caller must hold ip->lock, perhaps shared.
+int
+readiu(struct inode *ip, struct uio *uio, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
 
+  if(ip->dev == TMPDEV)
+    return tmpread(ip, uio, off, n);
+
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
+  if(ip->flags & DI_INLINE){
+    if(uiomove(ip->data + off, n, UIO_READ, uio) == -1)
+      return -1;
+    return n;
+  }
+
+  for(tot=0; tot<n; tot+=m, off+=m){
+    uint addr = bmap(ip, off/BSIZE, BMAP_LOOKUP);
+    if(addr != 0)
+      bp = bread(ip->dev, addr);
+    else if(ip->ndelay == 0 ||
+            (bp = bgetdelay(ip->dev, ip->inum, off/BSIZE, 0)) == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(uiomove(bp->data + (off % BSIZE), m, UIO_READ, uio) == -1) {
       brelse(bp);
       tot = -1;
       break;
@@ -505,39 +1265,136 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  struct iovec iov;
+  struct uio uio;
+
+  iov.iov_base = (void*)src;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, user_src ? myproc()->pagetable : 0);
+  return writeiu(ip, &uio, off, n);
+}
+
+// Write n bytes from uio's buffers to inode, like writei().
+// n must not exceed uio->resid.
+// Caller must hold ip->lock.
+int
+writeiu(struct inode *ip, struct uio *uio, uint off, uint n)
+{
+  uint tot;
+
+  if(ip->dev == TMPDEV){
+    tot = tmpwrite(ip, uio, off, n);
+    iupdate(ip);
+    return tot;
+  }
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
-      break;
+  if(ip->type == T_FILE && off + n <= NINLINE &&
+     ((ip->flags & DI_INLINE) || iempty(ip))){
+    // Small file: keep the content in the inode.
+    tot = 0;
+    if(uiomove(ip->data + off, n, UIO_WRITE, uio) == 0){
+      ip->flags |= DI_INLINE;
+      tot = n;
     }
-    log_write(bp);
-    brelse(bp);
+  } else {
+    if((ip->flags & DI_INLINE) && ispill(ip) < 0)
+      return -1;
+    tot = wblocks(ip, uio, off, n);
   }
+  off += tot;
 
   if(off > ip->size)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
-  // because the loop above might have called bmap() and added a new
+  // because wblocks() might have called bmap() and added a new
   // block to ip->addrs[].
   iupdate(ip);
 
   return tot;
 }
 
+// Does ip have no content at all?
+static int
+iempty(struct inode *ip)
+{
+  int i;
+
+  if(ip->size != 0 || ip->ndelay != 0)
+    return 0;
+  for(i = 0; i < NDIRECT+2; i++){
+    if(ip->addrs[i] != 0)
+      return 0;
+  }
+  return 1;
+}
+
+// Move ip's inline content out to a block, so that it can grow.
+// If there is no room for the block, leave the content inline
+// and return -1.
+static int
+ispill(struct inode *ip)
+{
+  uchar tmp[NINLINE];
+  struct iovec iov;
+  struct uio uio;
+  uint n;
+
+  n = ip->size;
+  memmove(tmp, ip->data, n);
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->flags &= ~DI_INLINE;
+  iov.iov_base = tmp;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, 0);
+  if(wblocks(ip, &uio, 0, n) != n){
+    // Give up block 0, if wblocks() got one, and put the
+    // content back: ip->data and ip->addrs[] share space.
+    if(ip->ndelay > 0)
+      idiscard(ip);
+    if(ip->addrs[0] != 0)
+      bfree(ip->dev, ip->addrs[0]);
+    memmove(ip->data, tmp, n);
+    ip->flags |= DI_INLINE;
+    return -1;
+  }
+  return 0;
+}
+
+// Write n bytes from uio to ip's blocks, for writeiu().
+// Returns the number of bytes written.
+static uint
+wblocks(struct inode *ip, struct uio *uio, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m){
+    uint addr = bmap(ip, off/BSIZE, BMAP_LOOKUP);
+    if(addr != 0)
+      bp = bread(ip->dev, addr);
+    else if((bp = idelay(ip, off/BSIZE)) == 0){
+      if((addr = bmap(ip, off/BSIZE, BMAP_ALLOC)) == 0)
+        break;
+      bp = bread(ip->dev, addr);
+    }
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(uiomove(bp->data + (off % BSIZE), m, UIO_WRITE, uio) == -1) {
+      brelse(bp);
+      break;
+    }
+    if(!bp->delay)
+      log_write(bp);
+    brelse(bp);
+  }
+  return tot;
+}
+
 // Directories
 
 int
@@ -546,32 +1403,390 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories
+//
+// See fs.h for the format. Lookups read block 0 and one leaf.
+// When a leaf fills, it is split in two on the next hash bit,
+// doubling the index first if the leaf already uses all depth
+// bits. Leaves are never merged or freed.
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Read the n-byte index field at byte k of block 0 in blk.
+static uint
+dirhget(uchar *blk, int k, int n)
+{
+  uint v;
+
+  for(v = 0; n > 0; n--)
+    v = (v << 8) | blk[DIRHOFF(k + n - 1)];
+  return v;
+}
+
+static void
+dirhput(uchar *blk, int k, int n, uint v)
+{
+  for(; n > 0; n--, k++, v >>= 8)
+    blk[DIRHOFF(k)] = v & 0xff;
+}
+
+// Leaf slot i of the index.
+#define DIRHSLOT(i) (DIRH_INDEX + 2*(i))
+
+// Is dp a linear or a hashed directory?
+// Caller must hold dp->lock, perhaps shared: concurrent
+// readers all work out the same answer, and only store it
+// once they have.
+static int
+dirformat(struct inode *dp)
+{
+  struct buf *bp;
+  int fmt;
+
+  if(dp->dirfmt != DIR_UNKNOWN)
+    return dp->dirfmt;
+  fmt = DIR_LINEAR;
+  if(dp->dev != TMPDEV && dp->size >= DIRHASHBLK*BSIZE){
+    bp = bread(dp->dev, bmap(dp, 0, BMAP_LOOKUP));
+    if(((struct dirent*)bp->data)[2].inum == 0 &&
+       dirhget(bp->data, DIRH_MAGIC, 4) == DIRHMAGIC)
+      fmt = DIR_HASHED;
+    brelse(bp);
+  }
+  dp->dirfmt = fmt;
+  return fmt;
+}
+
+// Look for name in hashed directory dp.
+// Returns its inum and sets *poff, or returns 0.
+static uint
+dirhlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint fbn, gd, addr, inum;
+  struct buf *bp;
+  struct dirent *de;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, 0, BMAP_LOOKUP));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < 2; i++){  // "." and ".."
+    if(namecmp(name, de[i].name) == 0){
+      *poff = i * sizeof(*de);
+      inum = de[i].inum;
+      brelse(bp);
+      return inum;
+    }
+  }
+  gd = dirhget(bp->data, DIRH_DEPTH, 1);
+  fbn = dirhget(bp->data, DIRHSLOT(dirhash(name) & ((1 << gd) - 1)), 2);
+  brelse(bp);
+
+  if((addr = bmap(dp, fbn, BMAP_LOOKUP)) == 0)
+    panic("dirhlookup: no leaf");
+  bp = bread(dp->dev, addr);
+  de = (struct dirent*)bp->data;
+  inum = 0;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *poff = fbn * BSIZE + i * sizeof(*de);
+      inum = de[i].inum;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Split full leaf fbn of hashed directory dp, whose block 0
+// is ib, on hash bit ld (its local depth).
+// Returns 0 on success, -1 if out of disk space.
+static int
+dirhsplit(struct inode *dp, struct buf *ib, struct buf *lb, uint fbn, int ld)
+{
+  uint nfbn, addr, i, j, gd;
+  struct buf *nb;
+  struct dirent *de, *nde;
+
+  nfbn = dirhget(ib->data, DIRH_NLEAF, 2) + 1;
+  if((addr = bmap(dp, nfbn, BMAP_ALLOC)) == 0)
+    return -1;
+  dirhput(ib->data, DIRH_NLEAF, 2, nfbn);
+  if(dp->size < (nfbn + 1) * BSIZE){
+    dp->size = (nfbn + 1) * BSIZE;
+    iupdate(dp);
+  }
+
+  // Hash values with bit ld set now go to the new leaf.
+  gd = dirhget(ib->data, DIRH_DEPTH, 1);
+  for(i = 0; i < (1 << gd); i++){
+    if(dirhget(ib->data, DIRHSLOT(i), 2) == fbn && (i >> ld) & 1)
+      dirhput(ib->data, DIRHSLOT(i), 2, nfbn);
+  }
+
+  nb = bread(dp->dev, addr);
+  memset(nb->data, 0, BSIZE);
+  de = (struct dirent*)lb->data;
+  nde = (struct dirent*)nb->data;
+  for(i = 0, j = 0; i < DPB; i++){
+    if(de[i].inum != 0 && (dirhash(de[i].name) >> ld) & 1){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nb);
+  log_write(lb);
+  log_write(ib);
+  brelse(nb);
+
+  // Moved entries have new offsets.
+  dcachepurge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp.
+// Returns the new entry's offset, or -1 if there is no room.
+static int
+dirhinsert(struct inode *dp, char *name, uint inum)
+{
+  uint h, gd, ld, fbn, addr, i, n;
+  struct buf *ib, *lb;
+  struct dirent *de;
+  int off;
+
+  ib = bread(dp->dev, bmap(dp, 0, BMAP_LOOKUP));
+  h = dirhash(name);
+  for(off = -1;;){
+    gd = dirhget(ib->data, DIRH_DEPTH, 1);
+    fbn = dirhget(ib->data, DIRHSLOT(h & ((1 << gd) - 1)), 2);
+    if((addr = bmap(dp, fbn, BMAP_LOOKUP)) == 0)
+      panic("dirhinsert: no leaf");
+    lb = bread(dp->dev, addr);
+    de = (struct dirent*)lb->data;
+    for(i = 0; i < DPB; i++){
+      if(de[i].inum == 0)
+        break;
+    }
+    if(i < DPB){
+      memset(&de[i], 0, sizeof(de[i]));
+      strncpy(de[i].name, name, DIRSIZ);
+      de[i].inum = inum;
+      log_write(lb);
+      brelse(lb);
+      off = fbn * BSIZE + i * sizeof(*de);
+      break;
+    }
+
+    // The leaf is full. 2^(gd-ld) index slots point to it.
+    for(i = 0, n = 0; i < (1 << gd); i++){
+      if(dirhget(ib->data, DIRHSLOT(i), 2) == fbn)
+        n++;
+    }
+    for(ld = gd; n > 1; n >>= 1)
+      ld--;
+    if(ld == gd){
+      if(gd == DIRHMAXDEPTH){
+        brelse(lb);
+        break;
+      }
+      for(i = 0; i < (1 << gd); i++)
+        dirhput(ib->data, DIRHSLOT(i + (1 << gd)), 2, dirhget(ib->data, DIRHSLOT(i), 2));
+      dirhput(ib->data, DIRH_DEPTH, 1, gd + 1);
+    }
+    if(dirhsplit(dp, ib, lb, fbn, ld) < 0){
+      brelse(lb);
+      break;
+    }
+    brelse(lb);
+  }
+  brelse(ib);
+  return off;
+}
+
+// Turn linear directory dp, whose DIRHASHBLK blocks are full,
+// into a hashed directory. Returns 0 on success.
+// Caller must hold dp->lock and be in a transaction.
+static int
+dirconvert(struct inode *dp)
+{
+  struct dirent *de, *tmp;
+  struct buf *bp;
+  int b, i, n;
+
+  if(dp->dev == TMPDEV || DIRHASHBLK * BSIZE > PGSIZE ||
+     dp->size != DIRHASHBLK*BSIZE)
+    return -1;
+  bp = bread(dp->dev, bmap(dp, 0, BMAP_LOOKUP));
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(bp);
+    return -1;
+  }
+  brelse(bp);
+  if((tmp = (struct dirent*)kalloc()) == 0)
+    return -1;
+
+  // Save the entries and empty the blocks; block 1 is the
+  // first leaf, and the others become leaves as it splits.
+  n = 0;
+  for(b = 0; b < DIRHASHBLK; b++){
+    bp = bread(dp->dev, bmap(dp, b, BMAP_LOOKUP));
+    de = (struct dirent*)bp->data;
+    for(i = b == 0 ? 2 : 0; i < DPB; i++){
+      if(de[i].inum != 0)
+        tmp[n++] = de[i];
+    }
+    if(b == 0){
+      memset(&de[2], 0, BSIZE - 2*sizeof(*de));
+      dirhput(bp->data, DIRH_MAGIC, 4, DIRHMAGIC);
+      dirhput(bp->data, DIRH_DEPTH, 1, 0);
+      dirhput(bp->data, DIRH_NLEAF, 2, 1);
+      dirhput(bp->data, DIRHSLOT(0), 2, 1);
+    } else {
+      memset(bp->data, 0, BSIZE);
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  dp->dirfmt = DIR_HASHED;
+  dcachepurge(dp->dev, dp->inum);
+
+  for(i = 0; i < n; i++){
+    if(dirhinsert(dp, tmp[i].name, tmp[i].inum) < 0)
+      panic("dirconvert");
+  }
+  kfree((char*)tmp);
+  return 0;
+}
+
+// Directory iterator.
+//
+// Walks all entries of a directory, free ones included,
+// holding the buffer of the current block instead of calling
+// readi() for each entry. dirnext() returns a pointer into the
+// buffer; a caller that changes the entry must log_write(it.bp)
+// before the next dirnext() or dirend(). Tmpfs directories have
+// no buffers (it.bp is 0): their entries are changed in place.
+// Caller must hold dp->lock.
+
+void
+dirstart(struct diriter *it, struct inode *dp)
+{
+  it->dp = dp;
+  it->bp = 0;
+  it->off = 0;
+  it->cur = 0;
+}
+
+// Return the next entry and set it->cur to its offset,
+// or return 0 at the end of the directory.
+struct dirent*
+dirnext(struct diriter *it)
+{
+  uint addr;
+  struct dirent *de;
+
+  if(it->bp != 0 && it->off % BSIZE == 0){
+    brelse(it->bp);
+    it->bp = 0;
+  }
+  if(it->off + sizeof(*de) > it->dp->size)
+    return 0;
+  if(it->dp->dev == TMPDEV){
+    it->cur = it->off;
+    it->off += sizeof(*de);
+    return tmpdirent(it->dp, it->cur);
+  }
+  if(it->bp == 0){
+    if((addr = bmap(it->dp, it->off / BSIZE, BMAP_LOOKUP)) == 0)
+      panic("dirnext: hole");
+    it->bp = bread(it->dp->dev, addr);
+  }
+  de = (struct dirent*)(it->bp->data + it->off % BSIZE);
+  it->cur = it->off;
+  it->off += sizeof(*de);
+  return de;
+}
+
+void
+dirend(struct diriter *it)
+{
+  if(it->bp != 0)
+    brelse(it->bp);
+  it->bp = 0;
+}
+
+// Is directory dp empty except for "." and ".."?
+// Caller must hold dp->lock.
+int
+isdirempty(struct inode *dp)
+{
+  struct diriter it;
+  struct dirent *de;
+  int empty;
+
+  empty = 1;
+  dirstart(&it, dp);
+  while((de = dirnext(&it)) != 0){
+    if(it.cur >= 2*sizeof(*de) && de->inum != 0){
+      empty = 0;
+      break;
+    }
+  }
+  dirend(&it);
+  return empty;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, perhaps shared.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  struct dirent *de;
+  struct diriter it;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(!dcachelookup(dp->dev, dp->inum, name, &inum, &off)){
+    inum = 0;
+    if(dirformat(dp) == DIR_HASHED){
+      inum = dirhlookup(dp, name, &off);
+    } else {
+      dirstart(&it, dp);
+      while((de = dirnext(&it)) != 0){
+        if(de->inum == 0)
+          continue;
+        if(namecmp(name, de->name) == 0){
+          // entry matches path element
+          inum = de->inum;
+          off = it.cur;
+          break;
+        }
+      }
+      dirend(&it);
     }
+    dcacheenter(dp->dev, dp->inum, name, inum, inum ? off : 0);
   }
 
-  return 0;
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -580,7 +1795,8 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
-  struct dirent de;
+  struct dirent de, *dep;
+  struct diriter it;
   struct inode *ip;
 
   // Check that name is not present.
@@ -589,22 +1805,162 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
+  if(dirformat(dp) == DIR_LINEAR){
+    // Look for an empty dirent, and fill it in place.
+    dirstart(&it, dp);
+    while((dep = dirnext(&it)) != 0 && dep->inum != 0)
+      ;
+    if(dep != 0){
+      strncpy(dep->name, name, DIRSIZ);
+      dep->inum = inum;
+      if(it.bp)
+        log_write(it.bp);
+      off = it.cur;
+      dirend(&it);
+      dcacheenter(dp->dev, dp->inum, name, inum, off);
+      return 0;
+    }
+    dirend(&it);
+
+    // Full: append, unless it is time to switch to hashing.
+    if(dirconvert(dp) < 0){
+      off = dp->size;
+      strncpy(de.name, name, DIRSIZ);
+      de.inum = inum;
+      if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        return -1;
+      dcacheenter(dp->dev, dp->inum, name, inum, off);
+      return 0;
+    }
+  }
+
+  if((off = dirhinsert(dp, name, inum)) < 0)
+    return -1;
+  dcacheenter(dp->dev, dp->inum, name, inum, off);
+  return 0;
+}
+
+// Mount the file system on device dev over directory dp.
+// Caller must not hold dp->lock, and must be in a transaction.
+int
+mount(struct inode *dp, uint dev)
+{
+  struct mount *m, *mp;
+
+  if(dev >= NBDEV || dev == ROOTDEV || dp->mounted)
+    return -1;
+  if(dev != TMPDEV && bdevsw[dev].rw == 0)
+    return -1;
+  if(dp->dev == ROOTDEV && dp->inum == ROOTINO)
+    return -1;
+
+  acquire(&mtable.lock);
+  mp = 0;
+  for(m = mtable.m; m < mtable.m+NMOUNT; m++){
+    if(m->used && m->dev == dev){
+      release(&mtable.lock);
+      return -1;
+    }
+    if(!m->used && mp == 0)
+      mp = m;
+  }
+  if(mp == 0){
+    release(&mtable.lock);
+    return -1;
+  }
+  mp->used = 1;
+  mp->dev = dev;
+  release(&mtable.lock);
+
+  if(fsmount(dev) < 0){
+    acquire(&mtable.lock);
+    mp->used = 0;
+    release(&mtable.lock);
+    return -1;
+  }
+
+  acquire(&mtable.lock);
+  mp->root = iget(dev, ROOTINO);
+  mp->ip = idup(dp);
+  mp->root->mounted = 1;
+  dp->mounted = 1;
+  release(&mtable.lock);
+  return 0;
+}
+
+// Unmount the file system whose root is ip.
+// Fails if any other inode on its device is in use, or
+// if anyone but the caller and the mount table holds ip.
+// Caller must not hold ip->lock, and must be in a transaction.
+int
+umount(struct inode *ip)
+{
+  struct mount *m;
+  struct inode *dp;
+  int i, busy;
+
+  acquire(&mtable.lock);
+  for(m = mtable.m; m < mtable.m+NMOUNT; m++){
+    if(m->used && m->root == ip)
       break;
   }
+  if(m == mtable.m+NMOUNT){
+    release(&mtable.lock);
+    return -1;
+  }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  acquire(&itable.lock);
+  busy = ip->ref > 2;
+  for(i = 0; i < itable.ninode && !busy; i++){
+    dp = inodeat(i);
+    if(dp != ip && dp->dev == ip->dev && dp->ref > 0)
+      busy = 1;
+  }
+  release(&itable.lock);
+  if(busy){
+    release(&mtable.lock);
     return -1;
+  }
 
+  dp = m->ip;
+  dp->mounted = 0;
+  ip->mounted = 0;
+  m->ip = 0;
+  m->root = 0;
+  m->used = 0;
+  release(&mtable.lock);
+  iput(dp);
+  iput(ip);
   return 0;
 }
 
+// If ip is covered by a mount, return the mounted root
+// instead, dropping ip. If up is set, and ip is a mounted
+// root, return the directory it covers instead.
+// Caller must not hold ip->lock.
+static struct inode*
+mountcross(struct inode *ip, int up)
+{
+  struct mount *m;
+  struct inode *next;
+
+  if(!ip->mounted)  // racy, but only an early out
+    return ip;
+  next = 0;
+  acquire(&mtable.lock);
+  for(m = mtable.m; m < mtable.m+NMOUNT; m++){
+    if(m->used && m->ip == ip && !up)
+      next = idup(m->root);
+    else if(m->used && m->root == ip && up)
+      next = idup(m->ip);
+  }
+  release(&mtable.lock);
+  if(next == 0)
+    return ip;
+  iput(ip);
+  return next;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -644,10 +2000,24 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Return ip as namex()'s result. An FS call confined to
+// tmpfs (see beginpathop() in sysfile.c) has no transaction,
+// so its lookups may not end outside tmpfs.
+static struct inode*
+namexend(struct inode *ip)
+{
+  if(myproc()->tmpop && ip->dev != TMPDEV){
+    iput(ip);
+    return 0;
+  }
+  return ip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
-// Must be called inside a transaction since it calls iput().
+// Should be called inside a transaction since it calls iput(),
+// which otherwise starts one itself to free an inode.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
@@ -659,28 +2029,33 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    if(namecmp(name, "..") == 0)
+      ip = mountcross(ip, 1);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
-      return ip;
+      iunlockshared(ip);
+      return namexend(ip);
     }
     if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
-    iunlockput(ip);
-    ip = next;
+    iunlockshared(ip);
+    iput(ip);
+    ip = mountcross(next, 0);
   }
   if(nameiparent){
     iput(ip);
     return 0;
   }
-  return ip;
+  return namexend(ip);
 }
 
 struct inode*
@@ -24,9 +24,15 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// A regular file of up to NINLINE bytes keeps its content in
+// the inode itself, in place of the block addresses.
+#define NINLINE 240
+#define DI_INLINE 0x1   // dinode flag: content is inline
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +41,11 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // DI_INLINE
+  union {
+    uint addrs[NDIRECT+2];   // Data block addresses
+    uchar data[NINLINE];     // or the content, if DI_INLINE
+  };
 };
 
 // Inodes per block.
@@ -58,3 +68,26 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows DIRHASHBLK blocks is turned into an
+// extendible hash table. Block 0 still starts with "." and "..";
+// the rest of it holds the hash index, written into the name
+// bytes of dirents whose inum is 0, so that programs reading
+// the directory see only free entries. The index maps the low
+// depth bits of a name's hash to a leaf: an ordinary block of
+// dirents, at file blocks 1..nleaf.
+#define DIRHASHBLK    4
+#define DIRHMAGIC     0x68736964
+#define DIRHMAXDEPTH  8
+
+// Offset in block 0 of byte k of a hashed directory's index.
+#define DIRHOFF(k)    ((2 + (k)/DIRSIZ)*sizeof(struct dirent) + sizeof(ushort) + (k)%DIRSIZ)
+
+// Index fields (byte k), stored little-endian.
+#define DIRH_MAGIC    0  // 4 bytes: DIRHMAGIC
+#define DIRH_DEPTH    4  // 1 byte: number of hash bits used
+#define DIRH_NLEAF    5  // 2 bytes: number of leaves
+#define DIRH_INDEX    8  // 2 bytes each: leaf for each hash value
+
@@ -0,0 +1,129 @@
+// Futexes: waiting for a word of user memory to change.
+//
+// futexwait(addr, val) sleeps as long as the int at user
+// address addr holds val; futexwake(addr, n) wakes up to n
+// processes waiting on addr. User-level locks keep their
+// state in such a word, change it with atomic instructions,
+// and only call in here when they have to wait, or when
+// someone might be waiting.
+//
+// Waiters are keyed by the physical address of the word, so
+// threads, and processes sharing the page, meet at the same
+// key whatever address they know it by. Each waiter puts a
+// struct fwaiter, on its own kernel stack, on the list of a
+// hash bucket, and sleeps on it; the bucket's lock protects
+// the list. futexwait() checks the word while holding that
+// lock, and a waker changes the word before it takes the
+// lock, so a wakeup cannot slip in between the check and
+// the sleep.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+
+#define NFHASH 31
+
+struct fwaiter {
+  uint64 pa;             // physical address waited on
+  int woken;
+  struct fwaiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct fwaiter *head;
+} ftable[NFHASH];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFHASH; i++)
+    initlock(&ftable[i].lock, "futex");
+}
+
+// The physical address of user address addr in p,
+// or 0 if it is not a valid, aligned address of an int.
+// addr need not be below p->sz: it may be in shared memory.
+static uint64
+futexaddr(struct proc *p, uint64 addr)
+{
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if((pa = walkaddr(p->pagetable, PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return pa + (addr - PGROUNDDOWN(addr));
+}
+
+// Wait until woken up, if the int at addr is val.
+// Returns 0 when woken, or -1 if the int is not val (or addr
+// is bad) or the process has been killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct fwaiter w, **pp;
+  uint64 pa;
+  int b;
+
+  if((pa = futexaddr(p, addr)) == 0)
+    return -1;
+  b = (pa / sizeof(int)) % NFHASH;
+
+  acquire(&ftable[b].lock);
+  if(*(volatile int*)pa != val){
+    release(&ftable[b].lock);
+    return -1;
+  }
+  // Join the end of the list, so waiters are woken in order.
+  w.pa = pa;
+  w.woken = 0;
+  w.next = 0;
+  for(pp = &ftable[b].head; *pp != 0; pp = &(*pp)->next)
+    ;
+  *pp = &w;
+  while(!w.woken && !killed(p))
+    sleep(&w, &ftable[b].lock);
+  if(!w.woken){
+    for(pp = &ftable[b].head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&ftable[b].lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes waiting on addr.
+// Returns how many were woken, or -1 if addr is bad.
+int
+futexwake(uint64 addr, int n)
+{
+  struct fwaiter *w, **pp;
+  uint64 pa;
+  int b, nwoken;
+
+  if((pa = futexaddr(myproc(), addr)) == 0)
+    return -1;
+  b = (pa / sizeof(int)) % NFHASH;
+
+  nwoken = 0;
+  acquire(&ftable[b].lock);
+  for(pp = &ftable[b].head; (w = *pp) != 0 && nwoken < n; ){
+    if(w->pa != pa){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    nwoken++;
+  }
+  release(&ftable[b].lock);
+  return nwoken;
+}
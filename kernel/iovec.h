@@ -0,0 +1,5 @@
+// One buffer of a scatter/gather transfer.
+struct iovec {
+  void *iov_base;   // start address
+  uint64 iov_len;   // number of bytes
+};
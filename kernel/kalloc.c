@@ -1,6 +1,10 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// A page can have several owners, such as the page tables
+// a shared memory segment is mapped into: kdup() adds one,
+// and kfree() only frees the page when the last one lets go.
 
 #include "types.h"
 #include "param.h"
@@ -18,9 +22,12 @@ struct run {
   struct run *next;
 };
 
+#define PAGENO(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  ushort ref[PAGENO(PHYSTOP)];  // owners of each allocated page
 } kmem;
 
 void
@@ -43,6 +50,7 @@ freerange(void *pa_start, void *pa_end)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// If the page has other owners, just drop this one.
 void
 kfree(void *pa)
 {
@@ -51,6 +59,15 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGENO(pa)] > 1){
+    kmem.ref[PAGENO(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  kmem.ref[PAGENO(pa)] = 0;
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -72,11 +89,27 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.ref[PAGENO(r)] = 1;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Add an owner to page pa, which kalloc() returned.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGENO(pa)] < 1 || kmem.ref[PAGENO(pa)] == 0xffff)
+    panic("kdup: ref");
+  kmem.ref[PAGENO(pa)]++;
+  release(&kmem.lock);
+}
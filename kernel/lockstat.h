@@ -0,0 +1,13 @@
+// Statistics for one class of locks (all the locks with the
+// same name), as returned by the lockstat() system call.
+// Times are in units of the RISC-V time CSR.
+#define NLOCKCLASS 64  // max lock classes
+
+struct lockinfo {
+  char name[16];
+  int sleep;         // sleep-locks, not spin-locks?
+  uint64 nacquire;   // acquisitions
+  uint64 ncontend;   // acquisitions that had to wait
+  uint64 wait;       // total time spent waiting
+  uint64 maxhold;    // longest time any lock was held
+};
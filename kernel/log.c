@@ -6,6 +6,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "logstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -16,67 +18,126 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS of log
+// space for the call (begin_opn() reserves a different amount);
+// end_op() gives the reservation back. If the blocks already
+// in the log plus the outstanding reservations would overflow
+// the log, begin_op() sleeps until a commit or a checkpoint
+// frees up space.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+// mkfs chooses its size (sb.nlog); the kernel handles up to
+// LOGSIZE blocks. The on-disk log format:
+//   header blocks, containing n, tail, and a block # per log slot
+//   slot 0
+//   slot 1
 //   ...
+// The slots are used circularly: log entry i lives in slot
+// i % capacity. Entries tail..n-1 are committed but may not yet
+// be installed at their home locations. The header may span
+// several blocks; the first one, which holds n and tail, is always
+// written last, so writing it is the single atomic commit point.
+//
+// commit() only appends the transaction to the log. A kernel
+// thread, the checkpointer, installs committed blocks at their
+// home locations in the background and then advances tail.
+// Until a block is installed its buffer stays pinned in the
+// cache, so readers see the committed data.
 // Log appends are synchronous.
+//
+// In the default LOG_SYNC mode, end_op() commits as soon as no
+// FS calls are outstanding, so a system call's changes are on
+// disk when it returns. In LOG_RELAXED mode the running
+// transaction instead stays open across system calls and
+// collects their changes, and is committed when it fills a
+// quarter of the log, when begin_op() needs its space, every
+// COMMITTICKS ticks (by the committer thread), or when
+// log_force() asks, as fsync() does.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of the header, used for both the on-disk header blocks
+// and to keep track in memory of the committed log entries.
 struct logheader {
-  int n;
+  uint n;
+  uint tail;
   int block[LOGSIZE];
 };
 
+// Number of header ints (n, tail, then block #s) per header block.
+#define LOGHPB (BSIZE / sizeof(int))
+
 struct log {
   struct spinlock lock;
+  struct sleeplock headlock; // serializes commits and header writes
   int start;
-  int size;
+  int size;        // total log blocks, including the header
+  int nhead;       // header blocks
+  int capacity;    // slots, size - nhead
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by outstanding calls.
   int committing;  // in commit(), please wait.
+  int nwaiting;    // begin_op()s waiting for log space.
+  int wantcommit;  // commit when the outstanding calls finish.
+  int mode;        // LOG_SYNC or LOG_RELAXED
   int dev;
-  struct logheader lh;
+  struct logheader lh;          // committed entries
+  int ntxn;                     // blocks in the running transaction
+  struct buf *txn[LOGSIZE];     // pinned buffers of the running transaction
+  struct logstat stat;
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void checkpointer(void);
+static void committer(void);
+static void commitlocked(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   initlock(&log.lock, "log");
+  initsleeplock(&log.headlock, "loghead");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.nhead = (log.size + 2 + LOGHPB - 1) / LOGHPB;
+  log.capacity = log.size - log.nhead;
+  if(log.capacity < MAXOPBLOCKS || log.capacity > LOGSIZE)
+    panic("initlog: bad log size");
   log.dev = dev;
   recover_from_log();
+  if(kthread("logckpt", checkpointer) < 0)
+    panic("initlog: checkpointer");
+  if(kthread("logcommit", committer) < 0)
+    panic("initlog: committer");
 }
 
-// Copy committed blocks from log to their home location
+// Disk block holding log entry i.
+static int
+logslot(uint i)
+{
+  return log.start + log.nhead + i % log.capacity;
+}
+
+// Log blocks in use: committed but uninstalled entries
+// plus the running transaction.
+static int
+logused(void)
+{
+  return log.lh.n - log.lh.tail + log.ntxn;
+}
+
+// Copy committed blocks from log to their home location.
+// Only used when recovering, before anything else uses the cache.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
-  int tail;
+  uint i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (i = log.lh.tail; i != log.lh.n; i++) {
+    struct buf *lbuf = bread(log.dev, logslot(i)); // read log block
+    struct buf *dbuf = bread(log.dev, log.lh.block[i % log.capacity]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -86,103 +147,229 @@ install_trans(int recovering)
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  struct buf *buf;
+  int *h;
+  int hb, i;
+
+  for(hb = 0; hb < log.nhead; hb++){
+    buf = bread(log.dev, log.start + hb);
+    h = (int *) (buf->data);
+    i = 0;
+    if(hb == 0){
+      log.lh.n = h[0];
+      log.lh.tail = h[1];
+      i = 2;
+    }
+    for(; i < LOGHPB && hb * LOGHPB + i - 2 < log.capacity; i++)
+      log.lh.block[hb * LOGHPB + i - 2] = h[i];
+    brelse(buf);
   }
-  brelse(buf);
+  if(log.lh.n - log.lh.tail > log.capacity)
+    panic("read_head: bad log header");
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write one header block from the in-memory header,
+// with n and tail in the first block.
 static void
-write_head(void)
+write_headblock(int hb, uint n, uint tail)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  struct buf *buf = bread(log.dev, log.start + hb);
+  int *h = (int *) (buf->data);
+  int i = 0;
+
+  if(hb == 0){
+    h[0] = n;
+    h[1] = tail;
+    i = 2;
   }
+  for(; i < LOGHPB && hb * LOGHPB + i - 2 < log.capacity; i++)
+    h[i] = log.lh.block[hb * LOGHPB + i - 2];
   bwrite(buf);
   brelse(buf);
 }
 
+// Write the in-memory log header to disk, for a log
+// that holds entries tail..n-1, of which from..n-1 are new.
+// The header blocks holding the new entries' block #s go first;
+// the block holding n and tail goes last. Writing it is the true
+// point at which a transaction commits or a checkpoint takes effect.
+// Caller must hold log.headlock.
+static void
+write_head(uint from, uint n, uint tail)
+{
+  int hb, pos;
+  uint i;
+
+  for(hb = 1; hb < log.nhead; hb++){
+    for(i = from; i != n; i++){
+      pos = i % log.capacity;
+      if((pos + 2) / LOGHPB == hb){
+        write_headblock(hb, n, tail);
+        break;
+      }
+    }
+  }
+  write_headblock(0, n, tail);
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.lh.tail = 0;
+  write_head(0, 0, 0); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Like begin_op(), but reserves room for an operation
+// that writes up to nblocks distinct blocks.
+void
+begin_opn(int nblocks)
+{
+  if(nblocks < 1 || nblocks > log.capacity)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.wantcommit){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(logused() + log.reserved + nblocks > log.capacity){
+      if(log.ntxn > 0 && log.mode == LOG_RELAXED){
+        // the open transaction holds space; commit it.
+        if(log.outstanding == 0){
+          commitlocked();
+          continue;
+        }
+        log.wantcommit = 1;
+      }
+      // this op might exhaust log space; wait for a
+      // commit, and ask the checkpointer to free slots.
+      log.stat.nwait++;
+      log.nwaiting++;
+      wakeup(&log.lh);
       sleep(&log, &log.lock);
+      log.nwaiting--;
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
+      myproc()->logres = nblocks;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Max blocks a single operation may reserve with begin_opn().
+int
+log_capacity(void)
+{
+  return log.capacity;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless the log is in relaxed mode.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= p->logres;
+  p->logres = 0;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 &&
+     (log.mode == LOG_SYNC || log.wantcommit || log.ntxn >= log.capacity / 4)){
+    commitlocked();
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit the running transaction. Caller must hold log.lock,
+// with no FS calls outstanding; returns with it held.
+static void
+commitlocked(void)
+{
+  log.committing = 1;
+  log.wantcommit = 0;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  if(log.lh.n - log.lh.tail >= log.capacity / 2)
+    wakeup(&log.lh);  // time for a checkpoint
+  wakeup(&log);
+}
+
+// Commit all completed FS calls' changes, and wait
+// until they are on disk.
+void
+log_force(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing){
+      sleep(&log, &log.lock);
+    } else if(log.ntxn == 0){
+      break;
+    } else if(log.outstanding == 0){
+      commitlocked();
+      break;
+    } else {
+      // the last outstanding call's end_op() will commit.
+      log.wantcommit = 1;
+      sleep(&log, &log.lock);
+    }
   }
+  log.stat.nforce++;
+  release(&log.lock);
+}
+
+// Switch to LOG_SYNC or LOG_RELAXED mode.
+// Returns the old mode, or -1 if mode is not valid.
+int
+log_setmode(int mode)
+{
+  int old;
+
+  if(mode != LOG_SYNC && mode != LOG_RELAXED)
+    return -1;
+  acquire(&log.lock);
+  old = log.mode;
+  log.mode = mode;
+  release(&log.lock);
+  if(mode == LOG_SYNC)
+    log_force();
+  return old;
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the log slots
+// following the committed entries.
 static void
 write_log(void)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (i = 0; i < log.ntxn; i++) {
+    struct buf *to = bread(log.dev, logslot(log.lh.n + i)); // log block
+    struct buf *from = bread(log.dev, log.txn[i]->blockno); // cache block
     memmove(to->data, from->data, BSIZE);
     bwrite(to);  // write the log
     brelse(from);
@@ -193,12 +380,125 @@ write_log(void)
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  int i;
+  uint n;
+
+  if (log.ntxn > 0) {
+    acquiresleep(&log.headlock);
+    log.stat.ncommit++;
+    log.stat.nlogged += log.ntxn;
     write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    n = log.lh.n;
+    for(i = 0; i < log.ntxn; i++)
+      log.lh.block[(n + i) % log.capacity] = log.txn[i]->blockno;
+    write_head(n, n + log.ntxn, log.lh.tail);    // Write header to disk -- the real commit
+    acquire(&log.lock);
+    // The blocks are committed, so the checkpointer may now
+    // install their cached copies. Their pins pass from the
+    // transaction to the committed log entries.
+    for(i = 0; i < log.ntxn; i++)
+      log.txn[i]->logged = 0;
+    log.lh.n = n + log.ntxn;
+    log.ntxn = 0;
+    release(&log.lock);
+    releasesleep(&log.headlock);
+  }
+}
+
+// Install committed entries at their home locations, unpin
+// their buffers, and free their log slots.
+static void
+checkpoint(void)
+{
+  uint i, n, tail;
+  struct buf *b, *lbuf;
+
+  acquire(&log.lock);
+  tail = log.lh.tail;
+  n = log.lh.n;
+  release(&log.lock);
+
+  for(i = tail; i != n; i++){
+    // Holding b's lock, no FS call is half-way through changing it.
+    b = bread(log.dev, log.lh.block[i % log.capacity]);
+    if(b->logged){
+      // The running transaction has changed b since entry i
+      // committed, so install the committed copy from the log.
+      lbuf = bread(log.dev, logslot(i));
+      bwritecopy(log.dev, b->blockno, lbuf->data);
+      brelse(lbuf);
+    } else {
+      // The cached copy is the latest committed one.
+      bwrite(b);
+    }
+    bunpin(b);
+    brelse(b);
+  }
+
+  acquiresleep(&log.headlock);
+  acquire(&log.lock);
+  tail = n;
+  n = log.lh.n;
+  release(&log.lock);
+  if(tail == n){
+    // Drained: restart the log at slot 0.
+    write_head(0, 0, 0);
+    tail = n = 0;
+  } else {
+    write_head(n, n, tail);
+  }
+  acquire(&log.lock);
+  log.lh.n = n;
+  log.lh.tail = tail;
+  log.stat.ncheckpoint++;
+  wakeup(&log);
+  release(&log.lock);
+  releasesleep(&log.headlock);
+}
+
+// The checkpointer kernel thread. Checkpoints once the
+// committed entries fill half the log, or sooner if
+// begin_op() is waiting for space.
+static void
+checkpointer(void)
+{
+  uint ncommitted;
+
+  acquire(&log.lock);
+  for(;;){
+    ncommitted = log.lh.n - log.lh.tail;
+    if(ncommitted >= log.capacity / 2 || (ncommitted > 0 && log.nwaiting > 0)){
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+    } else {
+      sleep(&log.lh, &log.lock);
+    }
+  }
+}
+
+// The committer kernel thread. In relaxed mode, commits
+// the running transaction every COMMITTICKS ticks.
+static void
+committer(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMITTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    if(log.mode == LOG_RELAXED && log.ntxn > 0 && !log.committing){
+      if(log.outstanding == 0)
+        commitlocked();
+      else
+        log.wantcommit = 1;
+    }
+    release(&log.lock);
   }
 }
 
@@ -214,23 +514,43 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
-
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
-
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
+  if(b->dev != log.dev){
+    // only the root device has a log (see fsmount()),
+    // so write other devices' blocks straight through.
+    release(&log.lock);
+    bwrite(b);
+    return;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  if (logused() >= log.capacity)
+    panic("too big a transaction");
+
+  log.stat.nwrite++;
+  if(b->logged){
+    // log absorption: already in this transaction,
+    // so its single log copy will carry this write too.
+    log.stat.nabsorb++;
+  } else {
+    // Add new block to log.
+    log.txn[log.ntxn++] = b;
+    b->logged = 1;
     bpin(b);
-    log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Copy the log's configuration and counters to st.
+void
+log_stat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  st->size = log.size;
+  st->capacity = log.capacity;
+  st->inuse = logused();
+  st->reserved = log.reserved;
+  st->mode = log.mode;
+  release(&log.lock);
+}
@@ -0,0 +1,20 @@
+// Log commit modes, for the logmode() system call.
+#define LOG_SYNC    0  // commit at the end of each FS call
+#define LOG_RELAXED 1  // batch FS calls; fsync() to commit
+
+// Log configuration and counters, as returned by the
+// logstat() system call. Used to tune the log size.
+struct logstat {
+  int mode;        // LOG_SYNC or LOG_RELAXED
+  int size;        // log blocks on disk, including the header
+  int capacity;    // max blocks in one transaction
+  int inuse;       // blocks in the running transaction
+  int reserved;    // blocks reserved by outstanding FS calls
+  uint64 nwrite;   // log_write() calls
+  uint64 nabsorb;  // log_write()s of a block already in the transaction
+  uint64 ncommit;  // transactions committed
+  uint64 nlogged;  // blocks written to the log by commits
+  uint64 nwait;    // times begin_op() waited for log space
+  uint64 ncheckpoint; // checkpoints by the background checkpointer
+  uint64 nforce;   // log_force() calls, e.g. from fsync()
+};
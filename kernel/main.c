@@ -20,14 +20,20 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex wait table
+    shminit();       // shared memory segments
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    bdevinit();      // block device switch
     iinit();         // inode table
+    dcacheinit();    // directory name cache
+    tmpinit();       // in-memory file system
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    ramdiskinit();   // RAM disk
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
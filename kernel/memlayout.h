@@ -62,6 +62,17 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   shared memory attachments (see shm.c)
+//   threads' trapframes (see clone())
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the trapframe of a thread in proc[i], in the address space
+// it shares with its process.
+#define TTRAPFRAME(i) (TRAPFRAME - ((i)+1)*PGSIZE)
+
+// where a process attaches its shared memory segment i,
+// for i < NSHMPROC.
+#define SHMSLOT       ((uint64)SHMMAXPAGES*PGSIZE)
+#define SHMADDR(i)    (TTRAPFRAME(NPROC) - (NSHMPROC-(i))*SHMSLOT)
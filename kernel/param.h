@@ -2,13 +2,28 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       1000  // maximum number of in-memory i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define RAMDEV        2  // device number of the RAM disk
+#define TMPDEV        3  // device number of tmpfs
+#define NBDEV         4  // maximum block device number
+#define NMOUNT        4  // maximum number of mounted file systems
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes
+#define LOGSIZE      2048  // max blocks in on-disk log (mkfs picks the actual size)
+#define FLUSHTICKS   30   // ticks between writeouts of delayed file data
+#define COMMITTICKS  50   // max ticks a relaxed-mode transaction stays open
+#define NDELAY       256  // max delayed-allocation file blocks in the cache
+#define NDCACHE      128  // size of directory name cache
+#define NBUF         (LOGSIZE+NDELAY+256)  // size of disk block cache; must exceed the log
+#define FSSIZE       20000  // size of file system in blocks
+#define RAMDISKSIZE  2048  // size of RAM disk in blocks
+#define NTMPINODE    200   // max tmpfs inodes
+#define TMPPAGES     4096  // max pages of tmpfs data
 #define MAXPATH      128   // maximum file path name
+#define MAXIOV       16    // max buffers in a readv/writev
+#define NSHM         16    // max shared memory segments
+#define NSHMPROC     4     // max segments attached per process
+#define SHMMAXPAGES  256   // max pages in a shared memory segment
 #define MAXTICKETS   1000
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
 #define PIPESIZE 512
 
@@ -17,10 +19,13 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq pollq;
 };
 
+// Make a pipe, reading from *f0 and writing to *f1.
+// flags may include O_NONBLOCK, for both ends.
 int
-pipealloc(struct file **f0, struct file **f1)
+pipealloc(struct file **f0, struct file **f1, int flags)
 {
   struct pipe *pi;
 
@@ -35,13 +40,16 @@ pipealloc(struct file **f0, struct file **f1)
   pi->nwrite = 0;
   pi->nread = 0;
   initlock(&pi->lock, "pipe");
+  initwaitq(&pi->pollq, "pipepoll");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = (flags & O_NONBLOCK) != 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = (flags & O_NONBLOCK) != 0;
   (*f1)->pipe = pi;
   return 0;
 
@@ -66,6 +74,7 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  wqwake(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
     kfree((char*)pi);
@@ -73,8 +82,11 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// Write n bytes from user address addr to pi. If it fills
+// up, wait for a reader, unless nonblock: then return what
+// has been written, or -1 if nothing has.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i = 0;
   struct proc *pr = myproc();
@@ -87,6 +99,14 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
+      wqwake(&pi->pollq);
+      if(nonblock){
+        if(i == 0){
+          release(&pi->lock);
+          return -1;
+        }
+        break;
+      }
       sleep(&pi->nwrite, &pi->lock);
     } else {
       char ch;
@@ -97,13 +117,16 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     }
   }
   wakeup(&pi->nread);
+  wqwake(&pi->pollq);
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes from pi to user address addr. If it is
+// empty, wait for a writer, unless nonblock: then return -1.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   struct proc *pr = myproc();
@@ -111,7 +134,7 @@ piperead(struct pipe *pi, uint64 addr, int n)
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
+    if(killed(pr) || nonblock){
       release(&pi->lock);
       return -1;
     }
@@ -125,6 +148,25 @@ piperead(struct pipe *pi, uint64 addr, int n)
       break;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wqwake(&pi->pollq);
   release(&pi->lock);
   return i;
 }
+
+// What pi is ready for, for poll().
+int
+pipepoll(struct pipe *pi, struct pollent *pe)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  pollwait(&pi->pollq, pe);
+  if(pi->nread != pi->nwrite || !pi->writeopen)
+    r |= POLLIN;
+  if(!pi->writeopen)
+    r |= POLLHUP;
+  if(pi->nwrite != pi->nread + PIPESIZE || !pi->readopen)
+    r |= POLLOUT;
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,143 @@
+// poll(): wait for any of several files to become ready.
+//
+// A file that can make a reader or writer wait (a pipe, the
+// console) has a wait queue of the processes poll()ing it.
+// poll() asks each file, through filepoll(), what is ready,
+// and on the first round also puts a struct pollent on the
+// file's queue. Whenever the file might have become ready, it
+// calls wqwake(), which wakes just the processes on its queue,
+// with wakepoll(), rather than scanning the process table as
+// wakeup() does. Since each file adds the entry before it says
+// what is ready, poll() cannot miss a change between asking
+// and going to sleep; wakepoll() leaves p->pollwoken set for
+// a poller that has not gone to sleep yet.
+//
+// Files on disk never make a reader or writer wait, so they
+// are always ready and have no queue.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+
+struct pollent {
+  struct proc *p;         // the process in poll()
+  struct waitq *q;        // the queue it is on, or 0
+  struct pollent *next;
+};
+
+void
+initwaitq(struct waitq *q, char *name)
+{
+  initlock(&q->lock, name);
+  q->head = 0;
+}
+
+// Put pe on q, if it is not on a queue already.
+// Called by a file's poll function.
+void
+pollwait(struct waitq *q, struct pollent *pe)
+{
+  if(pe == 0 || pe->q != 0)
+    return;
+  acquire(&q->lock);
+  pe->q = q;
+  pe->next = q->head;
+  q->head = pe;
+  release(&q->lock);
+}
+
+static void
+pollunwait(struct pollent *pe)
+{
+  struct pollent **pp;
+
+  if(pe->q == 0)
+    return;
+  acquire(&pe->q->lock);
+  for(pp = &pe->q->head; *pp != pe; pp = &(*pp)->next)
+    ;
+  *pp = pe->next;
+  release(&pe->q->lock);
+  pe->q = 0;
+}
+
+// Wake up the processes polling q.
+void
+wqwake(struct waitq *q)
+{
+  struct pollent *pe;
+
+  acquire(&q->lock);
+  for(pe = q->head; pe != 0; pe = pe->next)
+    wakepoll(pe->p);
+  release(&q->lock);
+}
+
+// Wait until one of the n struct pollfds at user address
+// addr is ready, or for timeout ticks (forever if timeout is
+// negative), and set their revents.
+// Returns the number of ready fds, or -1.
+int
+poll(uint64 addr, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollent ent[NOFILE];
+  struct file *f[NOFILE];
+  int i, r, nready;
+  uint start;
+
+  if(n < 0 || n > NOFILE ||
+     copyin(p->pagetable, (char*)fds, addr, n * sizeof(fds[0])) < 0)
+    return -1;
+
+  // Hold on to the files, in case another thread closes
+  // them while they have our entries on their queues.
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && p->ofile[fds[i].fd] != 0)
+      f[i] = filedup(p->ofile[fds[i].fd]);
+    ent[i].p = p;
+    ent[i].q = 0;
+  }
+
+  acquire(&tickslock);
+  start = ticks;
+  release(&tickslock);
+  for(;;){
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(f[i] == 0){
+        fds[i].revents = POLLNVAL;
+      } else {
+        r = filepoll(f[i], &ent[i]);
+        fds[i].revents = r & (fds[i].events | POLLHUP);
+      }
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0 || killed(p) ||
+       (timeout > 0 && ticks - start >= timeout))
+      break;
+    pollsleep(timeout > 0);
+  }
+
+  for(i = 0; i < n; i++){
+    pollunwait(&ent[i]);
+    if(f[i])
+      fileclose(f[i]);
+  }
+  if(killed(p) || copyout(p->pagetable, addr, (char*)fds, n * sizeof(fds[0])) < 0)
+    return -1;
+  return nready;
+}
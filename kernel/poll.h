@@ -0,0 +1,11 @@
+// A file descriptor for poll() to watch.
+struct pollfd {
+  int fd;           // ignored if negative
+  short events;     // events wanted
+  short revents;    // events that happened
+};
+
+#define POLLIN    0x001  // read won't block
+#define POLLOUT   0x004  // write won't block
+#define POLLHUP   0x010  // other end of a pipe is closed
+#define POLLNVAL  0x020  // fd is not open
@@ -19,6 +19,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -29,6 +30,13 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// lets kill() and procdump() scan the table for a pid
+// without taking every p->lock. allocproc() and freeproc()
+// hold it for writing while they change p->pid and p->state
+// from or to UNUSED, and always take it after p->lock, so
+// a reader must not acquire a p->lock while holding it.
+struct rwlock ptable_lock;
+
 uint TOT_TICKETS;
 
 // Allocate a page for each process's kernel stack.
@@ -56,6 +64,7 @@ procinit(void)
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initrwlock(&ptable_lock, "ptable");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -134,8 +143,10 @@ allocproc(void)
   return 0;
 
 found:
+  acquirewrite(&ptable_lock);
   p->pid = allocpid();
   p->state = USED;
+  releasewrite(&ptable_lock);
   p->creationTime = ticks;
 
   // Allocate a trapframe page.
@@ -155,6 +166,7 @@ found:
     release(&p->lock);
     return 0;
   }
+  p->tfva = TRAPFRAME;
 
 // #ifdef MLFQ
     // On the initiation of a process, push it to the end of the highest priority queue.
@@ -194,8 +206,9 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, unless p is a thread.
+// p->lock must be held, and wait_lock too if p is a
+// thread, since it changes the page table p shares.
 static void
 freeproc(struct proc *p)
 {
@@ -204,18 +217,26 @@ freeproc(struct proc *p)
   if(p->tf_copy)
     kfree((void*)p->tf_copy);
   p->trapframe = 0;
-  if(p->pagetable)
+  if(p->pagetable && p->thread)
+    uvmunmap(p->pagetable, p->tfva, 1, 0);  // the page table lives on
+  else if(p->pagetable){
+    shmexit(p);
     proc_freepagetable(p->pagetable, p->sz);
+  }
   p->pagetable = 0;
+  p->thread = 0;
+  p->ustack = 0;
   p->sz = 0;
-  p->pid = 0;
   p->parent = 0;
-  p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->rtime = 0;
   p->xstate = 0;
+  acquirewrite(&ptable_lock);
+  p->pid = 0;
+  p->name[0] = 0;
   p->state = UNUSED;
+  releasewrite(&ptable_lock);
   p->creationTime = 0;
   p->etime = 0;
   p->priority = 60;
@@ -308,23 +329,70 @@ userinit(void)
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct proc *q, *leader;
+
+  // Only p can give itself threads, so if it has none
+  // now, it will have none until this returns.
+  if(!threaded(p)){
+    oldsz = sz = p->sz;
+    if(n > 0){
+      if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+        return -1;
+      }
+    } else if(n < 0){
+      sz = uvmdealloc(p->pagetable, sz, sz + n);
+    }
+    p->sz = sz;
+    return oldsz;
+  }
 
-  sz = p->sz;
+  // The page table is shared: change it under wait_lock,
+  // and tell every thread the new size. Threads may not
+  // shrink it: the others could be using the pages, in
+  // copyin(), uvmcopy() or through TLB entries on other
+  // CPUs, which nothing here would flush.
+  if(n < 0)
+    return -1;
+  leader = p->thread ? p->parent : p;
+  acquire(&wait_lock);
+  oldsz = sz = p->sz;
   if(n > 0){
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&wait_lock);
       return -1;
     }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q == leader || (q->thread && q->parent == leader))
+      q->sz = sz;
+  }
+  release(&wait_lock);
+  return oldsz;
+}
+
+// Does p share its page table with other threads?
+int
+threaded(struct proc *p)
+{
+  struct proc *q;
+  int r;
+
+  if(p->thread)
+    return 1;
+  r = 0;
+  acquire(&wait_lock);
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q->thread && q->parent == p)
+      r = 1;
+  }
+  release(&wait_lock);
+  return r;
 }
 
 // Create a new process, copying the parent.
@@ -341,8 +409,10 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child, and share
+  // the parent's shared memory.
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 ||
+     shmfork(p, np) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
@@ -387,6 +457,178 @@ fork(void)
   return pid;
 }
 
+// Start a kernel thread that runs fn(), which must not return.
+// The thread has a process table entry, so it can sleep,
+// but it never runs in user space.
+// Returns the thread's pid, or -1 on failure.
+int
+kthread(char *name, void (*fn)(void))
+{
+  int pid;
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+
+  return pid;
+}
+
+// Create a thread: a new process that shares p's page table,
+// and starts in fcn(arg1, arg2) on the page-sized stack at
+// address stack. It is a child of p's process (p itself,
+// unless p is a thread), which join() reaps. It has its own
+// trapframe, mapped at TTRAPFRAME() of its proc[] slot, and
+// its own copies of p's file descriptors.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fcn, uint64 arg1, uint64 arg2, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(stack % sizeof(uint64) != 0 || stack + PGSIZE < stack ||
+     stack + PGSIZE > p->sz)
+    return -1;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // Use p's page table instead of a new one.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = 0;
+  np->tfva = TTRAPFRAME(np - proc);
+  np->mask = p->mask;
+
+  // Start in fcn. It must not return: there is nowhere to
+  // return to, so ra points nowhere.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fcn;
+  np->trapframe->sp = stack + PGSIZE;
+  np->trapframe->a0 = arg1;
+  np->trapframe->a1 = arg2;
+  np->trapframe->ra = -1;
+  np->ustack = stack;
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  if(mappages(p->pagetable, np->tfva, PGSIZE,
+              (uint64)(np->trapframe), PTE_R | PTE_W) < 0){
+    release(&wait_lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  np->thread = 1;
+  np->parent = p->thread ? p->parent : p;
+  release(&wait_lock);
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// Wait for a thread sharing p's page table to exit, and
+// reap it. Stores the stack it was given at address addr.
+// Returns its pid, or -1 if there are no other threads.
+int
+join(uint64 addr)
+{
+  struct proc *pp, *leader;
+  int havethreads, pid;
+  struct proc *p = myproc();
+
+  acquire(&wait_lock);
+  leader = p->thread ? p->parent : p;
+
+  for(;;){
+    havethreads = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp != p && pp->thread && pp->parent == leader){
+        acquire(&pp->lock);
+
+        havethreads = 1;
+        if(pp->state == ZOMBIE){
+          pid = pp->pid;
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->ustack,
+                                  sizeof(pp->ustack)) < 0) {
+            release(&pp->lock);
+            release(&wait_lock);
+            return -1;
+          }
+          freeproc(pp);
+          release(&pp->lock);
+          release(&wait_lock);
+          return pid;
+        }
+        release(&pp->lock);
+      }
+    }
+
+    if(!havethreads || killed(p)){
+      release(&wait_lock);
+      return -1;
+    }
+
+    // Exiting threads wake up their parent, the leader.
+    sleep(leader, &wait_lock);
+  }
+}
+
+// Kill p's threads and wait for them to exit, so that p can
+// give up the page table they share.
+// Caller must hold wait_lock.
+static void
+reapthreads(struct proc *p)
+{
+  struct proc *pp;
+  int n;
+
+  for(;;){
+    n = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp->thread && pp->parent == p){
+        acquire(&pp->lock);
+        if(pp->state == ZOMBIE){
+          freeproc(pp);
+        } else {
+          pp->killed = 1;
+          if(pp->state == SLEEPING)
+            pp->state = RUNNABLE;
+          n++;
+        }
+        release(&pp->lock);
+      }
+    }
+    if(n == 0)
+      return;
+    sleep(p, &wait_lock);
+  }
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -429,6 +671,10 @@ exit(int status)
 
   acquire(&wait_lock);
 
+  // A process takes its threads with it.
+  if(!p->thread)
+    reapthreads(p);
+
   // Give any children to init.
   reparent(p);
 
@@ -463,7 +709,7 @@ wait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+      if(pp->parent == p && !pp->thread){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -509,7 +755,7 @@ int waitx(uint64 addr, uint* wtime, uint* rtime)
     // Scan through table looking for exited children.
     havekids = 0;
     for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+      if(np->parent == p && !np->thread){
         // make sure the child isn't still in exit() or swtch().
         acquire(&np->lock);
 
@@ -968,6 +1214,18 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -1017,6 +1275,37 @@ wakeup(void *chan)
   }
 }
 
+// Sleep in poll() until wakepoll(), unless it has been called
+// since the last pollsleep(). If timed, also wake at the next
+// clock tick.
+void
+pollsleep(int timed)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(!p->pollwoken){
+    p->chan = timed ? (void*)&ticks : (void*)&p->pollwoken;
+    p->state = SLEEPING;
+    sched();
+    p->chan = 0;
+  }
+  p->pollwoken = 0;
+  release(&p->lock);
+}
+
+// Wake p from pollsleep(), or stop its next one sleeping.
+// Unlike wakeup(), this looks at just the one process.
+void
+wakepoll(struct proc *p)
+{
+  acquire(&p->lock);
+  p->pollwoken = 1;
+  if(p->state == SLEEPING && (p->chan == &p->pollwoken || p->chan == &ticks))
+    p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
@@ -1025,20 +1314,28 @@ kill(int pid)
 {
   struct proc *p;
 
+  acquireread(&ptable_lock);
   for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+    if(p->pid == pid)
+      break;
+  }
+  releaseread(&ptable_lock);
+  if(p == &proc[NPROC])
+    return -1;
+
+  // p may have exited since; pids are never reused.
+  acquire(&p->lock);
+  if(p->pid != pid){
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -1092,7 +1389,8 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Only the read side of ptable_lock, and no p->lock, to
+// avoid wedging a stuck machine further.
 void
 procdump(void)
 {
@@ -1122,6 +1420,7 @@ procdump(void)
 //   printf("PID Priority State rtime wtime nrun q0 q1 q2 q3 q4\n");
 // #endif
 
+  acquireread(&ptable_lock);
   for(p = proc; p < &proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
@@ -1150,4 +1449,5 @@ procdump(void)
 #endif
     printf("\n");
   }
+  releaseread(&ptable_lock);
 }
@@ -98,6 +98,7 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int pollwoken;               // a file poll() waits on may be ready
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -107,6 +108,10 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // user address of trapframe
+  int thread;                  // shares its parent's page table, see clone()
+  uint64 ustack;               // thread: the stack clone() was given
+  struct shmseg *shm[NSHMPROC]; // attached shared memory, see shm.c
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -131,5 +136,8 @@ struct proc {
   int flag_alarm;
   int alarm_ticks;
   int mask; //mask number for trace syscall
+  int logres;                  // log blocks reserved by begin_op()
+  int tmpop;                   // in an FS call confined to tmpfs, without one
+  void (*kfn)(void);           // kernel thread body, see kthread()
   int time_inq[5];
 };
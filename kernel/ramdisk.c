@@ -1,45 +1,112 @@
 //
-// ramdisk that uses the disk image loaded by qemu -initrd fs.img
+// RAM disk: a block device kept in kalloc()ed pages.
+// It starts out holding an empty file system, which can be
+// mounted next to the root file system; its contents are
+// lost at reboot.
 //
 
 #include "types.h"
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
-#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
+
+#define BPP      (PGSIZE / BSIZE)  // blocks per page
+#define NINODES  200
+
+struct {
+  struct spinlock lock;
+  char *page[RAMDISKSIZE / BPP];  // 0 until a block in it is written
+} ramdisk;
+
+// Return the address of block bno, or 0 if it has never been
+// written and alloc is not set.
+static char*
+ramblock(uint bno, int alloc)
+{
+  char **pp = &ramdisk.page[bno / BPP];
+
+  if(*pp == 0){
+    if(!alloc)
+      return 0;
+    if((*pp = kalloc()) == 0)
+      panic("ramdisk: out of memory");
+    memset(*pp, 0, PGSIZE);
+  }
+  return *pp + (bno % BPP) * BSIZE;
+}
 
 void
 ramdiskinit(void)
 {
+  struct superblock sb;
+  struct dinode *dip;
+  struct dirent *de;
+  uint nbitmap, ninodeblocks, nmeta, b;
+  char *bp;
+
+  initlock(&ramdisk.lock, "ramdisk");
+
+  // Lay out an empty file system, as mkfs would, but with
+  // no log: nothing on a RAM disk survives a crash anyway.
+  nbitmap = RAMDISKSIZE / BPB + 1;
+  ninodeblocks = NINODES / IPB + 1;
+  nmeta = 2 + ninodeblocks + nbitmap;
+  sb.magic = FSMAGIC;
+  sb.size = RAMDISKSIZE;
+  sb.nblocks = RAMDISKSIZE - nmeta;
+  sb.ninodes = NINODES;
+  sb.nlog = 0;
+  sb.logstart = 2;
+  sb.inodestart = 2;
+  sb.bmapstart = 2 + ninodeblocks;
+  memmove(ramblock(1, 1), &sb, sizeof(sb));
+
+  // The root directory, in the first data block.
+  dip = (struct dinode*)ramblock(IBLOCK(ROOTINO, sb), 1) + ROOTINO % IPB;
+  dip->type = T_DIR;
+  dip->nlink = 1;
+  dip->size = BSIZE;
+  dip->addrs[0] = nmeta;
+  de = (struct dirent*)ramblock(nmeta, 1);
+  de[0].inum = ROOTINO;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  strncpy(de[1].name, "..", DIRSIZ);
+
+  // Mark the metadata blocks and the root's block in use.
+  for(b = 0; b <= nmeta; b++){
+    bp = ramblock(BBLOCK(b, sb), 1);
+    bp[(b % BPB) / 8] |= 1 << (b % 8);
+  }
+
+  // Copying a block never sleeps, so requests need not queue.
+  bdevsw[RAMDEV].rw = ramdiskrw;
+  bdevsw[RAMDEV].depth = NCPU;
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Read (write == 0) or write b's block.
 void
-ramdiskrw(struct buf *b)
+ramdiskrw(struct buf *b, int write)
 {
+  char *addr;
+
   if(!holdingsleep(&b->lock))
     panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= RAMDISKSIZE)
     panic("ramdiskrw: blockno too big");
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
-
-  if(b->flags & B_DIRTY){
-    // write
-    memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
+  acquire(&ramdisk.lock);
+  if(write){
+    memmove(ramblock(b->blockno, 1), b->data, BSIZE);
+  } else if((addr = ramblock(b->blockno, 0)) != 0){
     memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+  } else {
+    memset(b->data, 0, BSIZE);
   }
+  release(&ramdisk.lock);
 }
@@ -0,0 +1,298 @@
+// Shared memory segments.
+//
+// A segment is a named set of zeroed pages. shmcreate() makes
+// one (or finds the one with that name), shmattach() maps it
+// into the calling process, and shmdetach() unmaps it, so
+// processes that attach the same segment see each other's
+// writes with no copying. A segment lasts until shmremove()
+// of its name, and then until its last attachment goes, so it
+// is there for processes that will attach it later. Its id
+// includes a count of the uses of its slot, so an id kept
+// after the segment goes cannot attach a later segment.
+//
+// A process attaches up to NSHMPROC segments, slot i at the
+// fixed address SHMADDR(i), above any heap, so they are not
+// part of p->sz: uvmcopy() and uvmfree() leave them alone.
+// Instead fork() attaches the parent's segments to the child
+// too, and exec() and exit() detach them all. Threads share
+// the attachments of their process, p->parent. A threaded
+// process cannot detach a segment: its threads may still be
+// using the pages, through TLB entries on other CPUs that
+// nothing would flush, so they must not be freed.
+//
+// The segment and each page table that maps a page own the
+// page (see kdup()), so pages outlive whichever is first to
+// go.
+//
+// shm.lock protects the segments and every p->shm[]. Page
+// tables shared by threads change under wait_lock, which
+// must be acquired before shm.lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SHMNAME 16
+
+struct shmseg {
+  char name[SHMNAME];
+  int used;
+  int removed;            // by shmremove(), so it has no name
+  int gen;                // times the slot has been used
+  int nattach;            // attachments
+  int npages;
+  char *pages[SHMMAXPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+extern struct spinlock wait_lock;
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+// The process whose attachments p uses.
+static struct proc*
+shmowner(struct proc *p)
+{
+  return p->thread ? p->parent : p;
+}
+
+// Free seg's pages and its slot.
+// Caller must hold shm.lock.
+static void
+shmfree(struct shmseg *seg)
+{
+  int i;
+
+  for(i = 0; i < seg->npages; i++)
+    kfree(seg->pages[i]);
+  seg->npages = 0;
+  seg->used = 0;
+}
+
+// Map seg at SHMADDR(slot) in pagetable.
+// Returns 0, or -1 with nothing mapped.
+// Caller must hold shm.lock.
+static int
+shmmap(pagetable_t pagetable, struct shmseg *seg, int slot)
+{
+  int i;
+
+  for(i = 0; i < seg->npages; i++){
+    if(mappages(pagetable, SHMADDR(slot) + i*PGSIZE, PGSIZE,
+                (uint64)seg->pages[i], PTE_R | PTE_W | PTE_U) < 0){
+      uvmunmap(pagetable, SHMADDR(slot), i, 1);
+      return -1;
+    }
+    kdup(seg->pages[i]);
+  }
+  seg->nattach++;
+  return 0;
+}
+
+// Unmap the segment in slot of p's attachments.
+// Caller must hold shm.lock.
+static void
+shmunmap(struct proc *p, pagetable_t pagetable, int slot)
+{
+  struct shmseg *seg = p->shm[slot];
+
+  uvmunmap(pagetable, SHMADDR(slot), seg->npages, 1);
+  p->shm[slot] = 0;
+  if(--seg->nattach == 0 && seg->removed)
+    shmfree(seg);
+}
+
+// The id of seg.
+static int
+shmid(struct shmseg *seg)
+{
+  return seg->gen * NSHM + (seg - shm.seg);
+}
+
+// The segment called name, or 0.
+// Caller must hold shm.lock.
+static struct shmseg*
+shmlookup(char *name)
+{
+  struct shmseg *seg;
+
+  for(seg = shm.seg; seg < &shm.seg[NSHM]; seg++){
+    if(seg->used && !seg->removed && strncmp(seg->name, name, SHMNAME) == 0)
+      return seg;
+  }
+  return 0;
+}
+
+// Find or create the segment called name, of at least size
+// bytes. Returns its id, or -1.
+int
+shmcreate(char *name, int size)
+{
+  struct shmseg *seg, *free;
+  int n, i;
+
+  n = PGROUNDUP((uint64)size) / PGSIZE;
+  if(size <= 0 || n > SHMMAXPAGES)
+    return -1;
+
+  acquire(&shm.lock);
+  if((seg = shmlookup(name)) != 0){
+    release(&shm.lock);
+    return seg->npages >= n ? shmid(seg) : -1;
+  }
+  free = 0;
+  for(seg = shm.seg; seg < &shm.seg[NSHM] && free == 0; seg++){
+    if(!seg->used)
+      free = seg;
+  }
+  if((seg = free) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; i < n; i++){
+    if((seg->pages[i] = kalloc()) == 0){
+      seg->npages = i;
+      shmfree(seg);
+      release(&shm.lock);
+      return -1;
+    }
+    memset(seg->pages[i], 0, PGSIZE);
+  }
+  seg->npages = n;
+  seg->used = 1;
+  seg->removed = 0;
+  seg->gen = (seg->gen + 1) % (0x7fffffff / NSHM);  // ids stay positive
+  seg->nattach = 0;
+  safestrcpy(seg->name, name, SHMNAME);
+  release(&shm.lock);
+  return shmid(seg);
+}
+
+// Remove the name of the segment called name, so that it
+// goes away once nothing has it attached.
+// Returns 0, or -1 if there is no such segment.
+int
+shmremove(char *name)
+{
+  struct shmseg *seg;
+
+  acquire(&shm.lock);
+  if((seg = shmlookup(name)) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  seg->removed = 1;
+  if(seg->nattach == 0)
+    shmfree(seg);
+  release(&shm.lock);
+  return 0;
+}
+
+// Map segment id into the current process.
+// Returns the address it is at, or -1.
+uint64
+shmattach(int id)
+{
+  struct proc *p = myproc();
+  struct proc *owner = shmowner(p);
+  struct shmseg *seg;
+  int slot;
+
+  if(id < 0)
+    return -1;
+  seg = &shm.seg[id % NSHM];
+
+  acquire(&wait_lock);
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC && owner->shm[slot] != 0; slot++)
+    ;
+  if(slot == NSHMPROC || !seg->used || seg->removed || shmid(seg) != id ||
+     shmmap(p->pagetable, seg, slot) < 0){
+    release(&shm.lock);
+    release(&wait_lock);
+    return -1;
+  }
+  owner->shm[slot] = seg;
+  release(&shm.lock);
+  release(&wait_lock);
+  return SHMADDR(slot);
+}
+
+// Unmap the segment attached at addr.
+// Returns 0, or -1 if there is none there or p is threaded.
+int
+shmdetach(uint64 addr)
+{
+  struct proc *p = myproc();
+  struct proc *owner = shmowner(p);
+  int slot;
+
+  // Only p can give itself threads, so if it has none
+  // now, it will have none until this returns.
+  if(threaded(p))
+    return -1;
+  acquire(&wait_lock);
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(owner->shm[slot] != 0 && SHMADDR(slot) == addr)
+      break;
+  }
+  if(slot == NSHMPROC){
+    release(&shm.lock);
+    release(&wait_lock);
+    return -1;
+  }
+  shmunmap(owner, p->pagetable, slot);
+  release(&shm.lock);
+  release(&wait_lock);
+  return 0;
+}
+
+// Attach p's segments to np, a new child, at the same
+// addresses. Returns 0, or -1 if np ran out of memory.
+int
+shmfork(struct proc *p, struct proc *np)
+{
+  struct proc *owner = shmowner(p);
+  int slot;
+
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(owner->shm[slot] == 0)
+      continue;
+    if(shmmap(np->pagetable, owner->shm[slot], slot) < 0){
+      release(&shm.lock);
+      return -1;
+    }
+    np->shm[slot] = owner->shm[slot];
+  }
+  release(&shm.lock);
+  return 0;
+}
+
+// Detach all of p's segments from its page table, because
+// p is exiting or exec()ing. p must have no threads.
+void
+shmexit(struct proc *p)
+{
+  int slot;
+
+  acquire(&shm.lock);
+  for(slot = 0; slot < NSHMPROC; slot++){
+    if(p->shm[slot] != 0)
+      shmunmap(p, p->pagetable, slot);
+  }
+  release(&shm.lock);
+}
@@ -1,4 +1,12 @@
 // Sleeping locks
+//
+// Sleep-locks are adaptive: most are held only briefly, so
+// if the holder is running on another CPU, a process that
+// wants the lock first spins for a little while, in the hope
+// that the holder lets go soon. That saves a sleep() and a
+// wakeup(), and the two context switches they cost. A holder
+// that is not running (or takes too long) will be a while,
+// so then the waiter sleeps.
 
 #include "types.h"
 #include "riscv.h"
@@ -9,6 +17,28 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+#define SPINTIME 500  // longest spin, in time units (50us in qemu)
+
+// Wait briefly for *ownerp to let go of a lock, while it is
+// running on another CPU. Called with lk held, which it drops
+// while spinning, so the caller must check the lock again.
+static void
+spinowner(struct spinlock *lk, struct proc **ownerp)
+{
+  struct proc *owner = *ownerp;
+  uint64 start;
+
+  if(owner == 0 || owner == myproc() || owner->state != RUNNING)
+    return;
+  release(lk);
+  start = r_time();
+  while(*(struct proc * volatile *)ownerp == owner &&
+        *(volatile enum procstate *)&owner->state == RUNNING &&
+        r_time() - start < SPINTIME)
+    ;
+  acquire(lk);
+}
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -16,17 +46,32 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->cls = lockclass(name, 1);
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0 = 0;
+  int contended = 0;
+
   acquire(&lk->lk);
+  if(lk->locked){
+    contended = 1;
+    t0 = r_time();
+    spinowner(&lk->lk, &lk->owner);
+  }
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  if(lk->cls){
+    lk->t0 = r_time();
+    lockcount(lk->cls, contended, lk->t0 - t0);
+  }
   release(&lk->lk);
 }
 
@@ -34,8 +79,11 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->cls)
+    lockhold(lk->cls, r_time() - lk->t0);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -51,5 +99,108 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Reader-writer sleep locks.
+
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->pid = 0;
+  lk->owner = 0;
+  lk->cls = lockclass(name, 1);
+}
+
+// Acquire lk for reading, alongside any other readers.
+// For lockstat(), a read hold lasts from the first reader
+// in to the last one out.
+void
+acquirereadsleep(struct rwsleeplock *lk)
+{
+  uint64 t0 = 0;
+  int contended = 0;
+
+  acquire(&lk->lk);
+  if(lk->locked || lk->wwait){
+    contended = 1;
+    t0 = r_time();
+    spinowner(&lk->lk, &lk->owner);
+  }
+  while(lk->locked || lk->wwait){
+    sleep(lk, &lk->lk);
+  }
+  if(lk->readers++ == 0 && lk->cls)
+    lk->t0 = r_time();
+  if(lk->cls)
+    lockcount(lk->cls, contended, r_time() - t0);
+  release(&lk->lk);
+}
 
+void
+releasereadsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasereadsleep");
+  if(--lk->readers == 0){
+    if(lk->cls)
+      lockhold(lk->cls, r_time() - lk->t0);
+    wakeup(lk);
+  }
+  release(&lk->lk);
+}
 
+void
+acquirewritesleep(struct rwsleeplock *lk)
+{
+  uint64 t0 = 0;
+  int contended = 0;
+
+  acquire(&lk->lk);
+  if(lk->locked || lk->readers){
+    contended = 1;
+    t0 = r_time();
+    spinowner(&lk->lk, &lk->owner);
+  }
+  lk->wwait++;
+  while(lk->locked || lk->readers){
+    sleep(lk, &lk->lk);
+  }
+  lk->wwait--;
+  lk->locked = 1;
+  lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  if(lk->cls){
+    lk->t0 = r_time();
+    lockcount(lk->cls, contended, lk->t0 - t0);
+  }
+  release(&lk->lk);
+}
+
+void
+releasewritesleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->cls)
+    lockhold(lk->cls, r_time() - lk->t0);
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->owner = 0;
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+// Does this process hold lk for writing?
+int
+holdingwritesleep(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && (lk->pid == myproc()->pid);
+  release(&lk->lk);
+  return r;
+}
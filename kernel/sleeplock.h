@@ -3,8 +3,32 @@ struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
   
+  struct proc *owner; // Process holding lock, for adaptive spinning
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For lockstat():
+  int cls;           // lock class + 1, or 0 if not counted
+  uint64 t0;         // when the lock was acquired
 };
 
+// Reader-writer sleep lock: any number of readers, or one
+// writer. Once a writer is waiting, new readers wait too, so
+// a stream of readers cannot starve it.
+struct rwsleeplock {
+  uint locked;       // Is the lock held by a writer?
+  int readers;       // Number of readers, but not which ones
+  int wwait;         // Number of writers waiting
+  struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Writer holding lock, for adaptive spinning
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock for writing
+
+  // For lockstat():
+  int cls;           // lock class + 1, or 0 if not counted
+  uint64 t0;         // when the lock was acquired
+};
@@ -1,4 +1,12 @@
 // Mutual exclusion spin locks.
+//
+// These are ticket locks: acquire() takes the next ticket and
+// waits until the lock's owner field reaches it, and release()
+// advances owner. So waiters get the lock in the order they
+// asked for it, and they only read the lock while they wait;
+// only release() writes it. A waiter backs off in proportion
+// to the number of tickets ahead of its own, to leave the
+// memory bus to the holder.
 
 #include "types.h"
 #include "param.h"
@@ -7,13 +15,126 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+#define BACKOFF 64  // spin loop iterations per waiter ahead
+
+// Lock statistics.
+//
+// Locks are counted by class: all the locks with the same name
+// (say, every "buffer" sleep-lock) share one set of counters.
+// Each CPU has its own counters, which it updates with interrupts
+// off, so counting needs no atomic instructions and no cache
+// lines shared between CPUs. lockinfo() adds them up.
+struct lockcounts {
+  uint64 nacquire;
+  uint64 ncontend;
+  uint64 wait;
+  uint64 maxhold;
+};
+
+struct {
+  // never passed to initlock(), so it is not counted itself.
+  struct spinlock lock;
+  int n;
+  char *name[NLOCKCLASS];
+  char sleep[NLOCKCLASS];
+  struct lockcounts cpu[NCPU][NLOCKCLASS];
+} lockstats;
+
+// Find or make the class for locks called name.
+// Returns the class + 1, or 0 if the table is full.
+int
+lockclass(char *name, int sleep)
+{
+  int i;
+
+  acquire(&lockstats.lock);
+  for(i = 0; i < lockstats.n; i++){
+    if(lockstats.sleep[i] == sleep && strncmp(lockstats.name[i], name, 16) == 0)
+      break;
+  }
+  if(i == lockstats.n){
+    if(i == NLOCKCLASS){
+      release(&lockstats.lock);
+      return 0;
+    }
+    lockstats.name[i] = name;
+    lockstats.sleep[i] = sleep;
+    lockstats.n++;
+  }
+  release(&lockstats.lock);
+  return i + 1;
+}
+
+// Count an acquisition of a lock of class cls, which had
+// to wait if contended, for wait time units.
+// Interrupts must be off.
+void
+lockcount(int cls, int contended, uint64 wait)
+{
+  struct lockcounts *c;
+
+  if(cls == 0)
+    return;
+  c = &lockstats.cpu[cpuid()][cls-1];
+  c->nacquire++;
+  if(contended){
+    c->ncontend++;
+    c->wait += wait;
+  }
+}
+
+// Count a lock of class cls being held for hold time units.
+// Interrupts must be off.
+void
+lockhold(int cls, uint64 hold)
+{
+  struct lockcounts *c;
+
+  if(cls == 0)
+    return;
+  c = &lockstats.cpu[cpuid()][cls-1];
+  if(hold > c->maxhold)
+    c->maxhold = hold;
+}
+
+// Sum up the counters of class i into *li.
+// Returns -1 if there is no class i.
+int
+lockinfo(int i, struct lockinfo *li)
+{
+  struct lockcounts *c;
+  int id;
+
+  acquire(&lockstats.lock);
+  if(i < 0 || i >= lockstats.n){
+    release(&lockstats.lock);
+    return -1;
+  }
+  memset(li, 0, sizeof(*li));
+  safestrcpy(li->name, lockstats.name[i], sizeof(li->name));
+  li->sleep = lockstats.sleep[i];
+  for(id = 0; id < NCPU; id++){
+    c = &lockstats.cpu[id][i];
+    li->nacquire += c->nacquire;
+    li->ncontend += c->ncontend;
+    li->wait += c->wait;
+    if(c->maxhold > li->maxhold)
+      li->maxhold = c->maxhold;
+  }
+  release(&lockstats.lock);
+  return 0;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->cls = lockclass(name, 0);
 }
 
 // Acquire the lock.
@@ -21,16 +142,29 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 t0 = 0;
+  int contended = 0;
+  uint ticket, owner;
+  int i;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  //   s1 = &lk->next
+  //   amoadd.w a5, a5, (s1)
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  if(*(volatile uint *)&lk->owner != ticket){
+    contended = 1;
+    if(lk->cls)
+      t0 = r_time();
+    while((owner = *(volatile uint *)&lk->owner) != ticket){
+      for(i = (ticket - owner) * BACKOFF; i > 0; i--)
+        asm volatile("nop");
+    }
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +174,10 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  if(lk->cls){
+    lk->t0 = r_time();
+    lockcount(lk->cls, contended, lk->t0 - t0);
+  }
 }
 
 // Release the lock.
@@ -49,6 +187,8 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->cls)
+    lockhold(lk->cls, r_time() - lk->t0);
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +199,14 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock, handing it to the next ticket, equivalent
+  // to lk->owner++. This code doesn't use a C assignment, since
+  // the C standard implies that an assignment might be implemented
+  // with multiple store instructions.
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
+  //   s1 = &lk->owner
+  //   amoadd.w zero, a5, (s1)
+  __sync_fetch_and_add(&lk->owner, 1);
 
   pop_off();
 }
@@ -77,10 +217,83 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->next != lk->owner && lk->cpu == mycpu());
   return r;
 }
 
+// Reader-writer spin locks.
+//
+// rw->lk is only held while changing the counts, so readers
+// hold it for a moment each and then run in parallel. A
+// waiter spins reading the counts, and takes rw->lk again
+// only once they look right. Interrupts stay off from acquire
+// to release, as with a spinlock. A CPU must not acquire a
+// read lock it already holds: a writer waiting in between
+// would deadlock it.
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  initlock(&rw->lk, name);
+  rw->readers = 0;
+  rw->writer = 0;
+  rw->wwait = 0;
+}
+
+void
+acquireread(struct rwlock *rw)
+{
+  push_off();
+  acquire(&rw->lk);
+  while(rw->writer || rw->wwait){
+    release(&rw->lk);
+    while(*(volatile int *)&rw->writer || *(volatile int *)&rw->wwait)
+      asm volatile("nop");
+    acquire(&rw->lk);
+  }
+  rw->readers++;
+  release(&rw->lk);
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  acquire(&rw->lk);
+  if(rw->readers < 1)
+    panic("releaseread");
+  rw->readers--;
+  release(&rw->lk);
+  pop_off();
+}
+
+void
+acquirewrite(struct rwlock *rw)
+{
+  push_off();
+  acquire(&rw->lk);
+  rw->wwait++;
+  while(rw->writer || rw->readers){
+    release(&rw->lk);
+    while(*(volatile int *)&rw->writer || *(volatile int *)&rw->readers)
+      asm volatile("nop");
+    acquire(&rw->lk);
+  }
+  rw->wwait--;
+  rw->writer = 1;
+  release(&rw->lk);
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  acquire(&rw->lk);
+  if(!rw->writer)
+    panic("releasewrite");
+  rw->writer = 0;
+  release(&rw->lk);
+  pop_off();
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -1,9 +1,24 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock.
+// The lock is held when next != owner.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // next ticket to hand out
+  uint owner;        // ticket of the holder, or of the next one in
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  int cls;           // lock class + 1, or 0 if not counted
+  uint64 t0;         // when the lock was acquired
 };
 
+// Reader-writer spin lock: any number of readers, or one
+// writer, with waiting writers taking precedence over new
+// readers. Like a spinlock, it is held with interrupts off.
+struct rwlock {
+  struct spinlock lk; // protects the fields below
+  int readers;       // Number of readers holding the lock
+  int writer;        // Is the lock held by a writer?
+  int wwait;         // Number of writers waiting
+};
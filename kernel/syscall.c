@@ -107,6 +107,28 @@ extern uint64 sys_sigalarm(void);
 extern uint64 sys_sigreturn(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_settickets(void);
+extern uint64 sys_logstat(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_logmode(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_umount(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_shmcreate(void);
+extern uint64 sys_shmattach(void);
+extern uint64 sys_shmdetach(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_shmremove(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -138,6 +160,28 @@ static uint64 (*syscalls[])(void) = {
 [SYS_sigreturn]   sys_sigreturn,
 [SYS_trace]   sys_trace,
 [SYS_settickets]   sys_settickets,
+[SYS_logstat]   sys_logstat,
+[SYS_readv]   sys_readv,
+[SYS_writev]   sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]   sys_pwrite,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync]   sys_fdatasync,
+[SYS_logmode]   sys_logmode,
+[SYS_mount]   sys_mount,
+[SYS_umount]   sys_umount,
+[SYS_lockstat]   sys_lockstat,
+[SYS_clone]   sys_clone,
+[SYS_join]   sys_join,
+[SYS_futex_wait]   sys_futex_wait,
+[SYS_futex_wake]   sys_futex_wake,
+[SYS_shmcreate]   sys_shmcreate,
+[SYS_shmattach]   sys_shmattach,
+[SYS_shmdetach]   sys_shmdetach,
+[SYS_poll]   sys_poll,
+[SYS_fcntl]   sys_fcntl,
+[SYS_pipe2]   sys_pipe2,
+[SYS_shmremove]   sys_shmremove,
 };
 
 char *syscallnames[] = {
@@ -168,6 +212,28 @@ char *syscallnames[] = {
 [SYS_sigreturn]   "sigreturn",
 [SYS_trace]   "trace",
 [SYS_settickets] "settickets",
+[SYS_logstat] "logstat",
+[SYS_readv] "readv",
+[SYS_writev] "writev",
+[SYS_pread] "pread",
+[SYS_pwrite] "pwrite",
+[SYS_fsync] "fsync",
+[SYS_fdatasync] "fdatasync",
+[SYS_logmode] "logmode",
+[SYS_mount] "mount",
+[SYS_umount] "umount",
+[SYS_lockstat] "lockstat",
+[SYS_clone] "clone",
+[SYS_join] "join",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+[SYS_shmcreate] "shmcreate",
+[SYS_shmattach] "shmattach",
+[SYS_shmdetach] "shmdetach",
+[SYS_poll]      "poll",
+[SYS_fcntl]     "fcntl",
+[SYS_pipe2]     "pipe2",
+[SYS_shmremove] "shmremove",
 };
 
 int syscallnums[] = {
@@ -198,6 +264,28 @@ int syscallnums[] = {
 [SYS_sigreturn]   0,
 [SYS_trace]   1,
 [SYS_settickets] 1,
+[SYS_logstat] 1,
+[SYS_readv] 3,
+[SYS_writev] 3,
+[SYS_pread] 4,
+[SYS_pwrite] 4,
+[SYS_fsync] 1,
+[SYS_fdatasync] 1,
+[SYS_logmode] 1,
+[SYS_mount] 2,
+[SYS_umount] 1,
+[SYS_lockstat] 2,
+[SYS_clone] 4,
+[SYS_join] 1,
+[SYS_futex_wait] 2,
+[SYS_futex_wake] 2,
+[SYS_shmcreate] 2,
+[SYS_shmattach] 1,
+[SYS_shmdetach] 1,
+[SYS_poll]      3,
+[SYS_fcntl]     3,
+[SYS_pipe2]     2,
+[SYS_shmremove] 1,
 };
 
 void
@@ -25,4 +25,26 @@
 #define SYS_sigalarm  24
 #define SYS_sigreturn  25
 #define SYS_trace  26
-#define SYS_settickets 27
\ No newline at end of file
+#define SYS_settickets 27
+#define SYS_logstat 28
+#define SYS_readv  29
+#define SYS_writev 30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_fsync  33
+#define SYS_fdatasync 34
+#define SYS_logmode 35
+#define SYS_mount  36
+#define SYS_umount 37
+#define SYS_lockstat 38
+#define SYS_clone  39
+#define SYS_join   40
+#define SYS_futex_wait 41
+#define SYS_futex_wake 42
+#define SYS_shmcreate 43
+#define SYS_shmattach 44
+#define SYS_shmdetach 45
+#define SYS_poll 46
+#define SYS_fcntl 47
+#define SYS_pipe2 48
+#define SYS_shmremove 49
\ No newline at end of file
@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "iovec.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +97,101 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Copy in the user iovec array at addr and set up uio over it.
+static int
+argiov(uint64 addr, int iovcnt, struct iovec *iov, struct uio *uio)
+{
+  int i;
+
+  if(iovcnt < 0 || iovcnt > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, iovcnt*sizeof(iov[0])) < 0)
+    return -1;
+  uioinit(uio, iov, iovcnt, myproc()->pagetable);
+  // the total must fit in the int return value.
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].iov_len > 0x7fffffff)
+      return -1;
+  }
+  if(uio->resid > 0x7fffffff)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  struct uio uio;
+  uint64 p;
+  int n;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || argiov(p, n, iov, &uio) < 0)
+    return -1;
+  return filereadu(f, &uio, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  struct uio uio;
+  uint64 p;
+  int n;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || argiov(p, n, iov, &uio) < 0)
+    return -1;
+  return filewriteu(f, &uio, -1);
+}
+
+// Read at an explicit offset, leaving the file offset alone,
+// so that several readers can share one open file.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  struct uio uio;
+  uint64 p;
+  int n, off;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, myproc()->pagetable);
+  return filereadu(f, &uio, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  struct uio uio;
+  uint64 p;
+  int n, off;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  uioinit(&uio, &iov, 1, myproc()->pagetable);
+  return filewriteu(f, &uio, off);
+}
+
 uint64
 sys_close(void)
 {
@@ -119,6 +217,51 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Calls on tmpfs never write to the log, so a call whose
+// paths all lead into tmpfs runs without a transaction: it
+// neither reserves log space in begin_op() nor waits there
+// behind disk transactions. Its lookups are repeated for real
+// once the call starts, and namex() fails any that no longer
+// end in tmpfs, say because of a concurrent umount().
+
+// Does path lead into tmpfs? It is looked up with namei(),
+// or nameiparent() if parent is set.
+static int
+tmppath(char *path, int parent)
+{
+  struct inode *ip;
+  char name[DIRSIZ];
+  int tmp;
+
+  ip = parent ? nameiparent(path, name) : namei(path);
+  if(ip == 0)
+    return 0;
+  tmp = ip->dev == TMPDEV;
+  iput(ip);
+  return tmp;
+}
+
+// Start an FS call, in a transaction unless tmp.
+static void
+beginpathop(int tmp)
+{
+  if(tmp)
+    myproc()->tmpop = 1;
+  else
+    begin_op();
+}
+
+static void
+endpathop(void)
+{
+  struct proc *p = myproc();
+
+  if(p->tmpop)
+    p->tmpop = 0;
+  else
+    end_op();
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -129,16 +272,16 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  beginpathop(tmppath(old, 0) && tmppath(new, 1));
   if((ip = namei(old)) == 0){
-    end_op();
+    endpathop();
     return -1;
   }
 
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
-    end_op();
+    endpathop();
     return -1;
   }
 
@@ -156,7 +299,7 @@ sys_link(void)
   iunlockput(dp);
   iput(ip);
 
-  end_op();
+  endpathop();
 
   return 0;
 
@@ -165,26 +308,10 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
-  end_op();
+  endpathop();
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 uint64
 sys_unlink(void)
 {
@@ -196,9 +323,9 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  beginpathop(tmppath(path, 1));
   if((dp = nameiparent(path, name)) == 0){
-    end_op();
+    endpathop();
     return -1;
   }
 
@@ -214,7 +341,7 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (ip->mounted || !isdirempty(ip))){
     iunlockput(ip);
     goto bad;
   }
@@ -222,6 +349,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp->dev, dp->inum, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -232,13 +360,13 @@ sys_unlink(void)
   iupdate(ip);
   iunlockput(ip);
 
-  end_op();
+  endpathop();
 
   return 0;
 
 bad:
   iunlockput(dp);
-  end_op();
+  endpathop();
   return -1;
 }
 
@@ -314,30 +442,30 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  beginpathop(tmppath(path, (omode & O_CREATE) != 0));
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
-      end_op();
+      endpathop();
       return -1;
     }
   } else {
     if((ip = namei(path)) == 0){
-      end_op();
+      endpathop();
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & ~O_NONBLOCK) != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      endpathop();
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op();
+    endpathop();
     return -1;
   }
 
@@ -345,7 +473,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    endpathop();
     return -1;
   }
 
@@ -359,13 +487,14 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
 
   iunlock(ip);
-  end_op();
+  endpathop();
 
   return fd;
 }
@@ -376,13 +505,15 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  beginpathop(tmppath(path, 1));
+  if((ip = create(path, T_DIR, 0, 0)) == 0){
+    endpathop();
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  endpathop();
   return 0;
 }
 
@@ -393,16 +524,17 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
   argint(1, &major);
   argint(2, &minor);
-  if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
-    end_op();
+  if((argstr(0, path, MAXPATH)) < 0)
+    return -1;
+  beginpathop(tmppath(path, 1));
+  if((ip = create(path, T_DEVICE, major, minor)) == 0){
+    endpathop();
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  endpathop();
   return 0;
 }
 
@@ -474,16 +606,16 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// Make a pipe with the given O_ flags, and put its read
+// and write fds in the two ints at fdarray.
+static int
+makepipe(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  argaddr(0, &fdarray);
-  if(pipealloc(&rf, &wf) < 0)
+  if(pipealloc(&rf, &wf, flags) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
@@ -503,3 +635,159 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  argaddr(0, &fdarray);
+  return makepipe(fdarray, 0);
+}
+
+// pipe(), but with O_NONBLOCK allowed in flags.
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray;
+  int flags;
+
+  argaddr(0, &fdarray);
+  argint(1, &flags);
+  if(flags & ~O_NONBLOCK)
+    return -1;
+  return makepipe(fdarray, flags);
+}
+
+// Get or set the O_ flags of an open file. Only
+// O_NONBLOCK can be changed.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, flags;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    if(f->readable && f->writable)
+      flags = O_RDWR;
+    else if(f->writable)
+      flags = O_WRONLY;
+    else
+      flags = O_RDONLY;
+    if(f->nonblock)
+      flags |= O_NONBLOCK;
+    return flags;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Wait for some of an array of struct pollfds to be ready.
+uint64
+sys_poll(void)
+{
+  uint64 fds; // user pointer to array of struct pollfd
+  int n, timeout;
+
+  argaddr(0, &fds);
+  argint(1, &n);
+  argint(2, &timeout);
+  return poll(fds, n, timeout);
+}
+
+uint64
+sys_logstat(void)
+{
+  uint64 addr; // user pointer to struct logstat
+  struct logstat st;
+
+  argaddr(0, &addr);
+  log_stat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Switch the log between LOG_SYNC and LOG_RELAXED commits.
+uint64
+sys_logmode(void)
+{
+  int mode;
+
+  argint(0, &mode);
+  return log_setmode(mode);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// File data and metadata go through the same log,
+// so fdatasync() has nothing less to do than fsync().
+uint64
+sys_fdatasync(void)
+{
+  return sys_fsync();
+}
+
+// Mount block device dev's file system on a directory.
+uint64
+sys_mount(void)
+{
+  char path[MAXPATH];
+  struct inode *dp;
+  int dev, r;
+
+  argint(1, &dev);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  if((dp = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlockput(dp);
+    end_op();
+    return -1;
+  }
+  iunlock(dp);
+  r = mount(dp, dev);
+  iput(dp);
+  end_op();
+  return r;
+}
+
+uint64
+sys_umount(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  int r;
+
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  r = umount(ip);
+  iput(ip);
+  end_op();
+  return r;
+}
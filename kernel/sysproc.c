@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "lockstat.h"
 
 uint64
 sys_exit(void)
@@ -27,6 +28,89 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fcn, arg1, arg2, stack;
+
+  argaddr(0, &fcn);
+  argaddr(1, &arg1);
+  argaddr(2, &arg2);
+  argaddr(3, &stack);
+  return clone(fcn, arg1, arg2, stack);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return join(addr);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
+uint64
+sys_shmcreate(void)
+{
+  char name[16];
+  int size;
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  argint(1, &size);
+  return shmcreate(name, size);
+}
+
+uint64
+sys_shmattach(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmattach(id);
+}
+
+uint64
+sys_shmdetach(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shmdetach(addr);
+}
+
+uint64
+sys_shmremove(void)
+{
+  char name[16];
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  return shmremove(name);
+}
+
 uint64
 sys_wait(void)
 {
@@ -65,14 +149,10 @@ sys_set_priority(void)
 uint64
 sys_sbrk(void)
 {
-  uint64 addr;
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -175,4 +255,21 @@ sys_settickets(void)
   }
   return 0;
 
-}
\ No newline at end of file
+}
+// Copy statistics for up to n lock classes to the user
+// array at addr. Returns the number copied.
+uint64
+sys_lockstat(void)
+{
+  struct lockinfo li;
+  uint64 addr;
+  int i, n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  for(i = 0; i < n && lockinfo(i, &li) == 0; i++){
+    if(copyout(myproc()->pagetable, addr + i*sizeof(li), (char*)&li, sizeof(li)) < 0)
+      return -1;
+  }
+  return i;
+}
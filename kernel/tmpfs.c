@@ -0,0 +1,248 @@
+// Tmpfs: a file system kept entirely in memory.
+//
+// Inodes on device TMPDEV live in tmpfs.tnode[] instead of on
+// a disk, and their content in kalloc()ed pages, found through
+// a page of page pointers per file. So tmpfs files never use
+// the buffer cache, the log or a disk.
+//
+// fs.c calls in here from its inode routines (ialloc, ilock,
+// iupdate, itrunc, readiu, writeiu and dirnext) for inodes on
+// TMPDEV. Everything above those, including directories, path
+// lookup and the mount table, is shared with the disk file
+// system. The contents are lost at reboot.
+//
+// A tnode's contents are protected by the sleep-lock of its
+// in-memory inode, of which there is at most one; tmpfs.lock
+// protects allocating and freeing tnodes and pages.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "iovec.h"
+#include "uio.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NPTR (PGSIZE / sizeof(char*))  // max pages per file
+
+struct tnode {
+  short type;    // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **pages;  // page of pointers to the content pages, or 0
+};
+
+struct {
+  struct spinlock lock;
+  struct tnode tnode[NTMPINODE];
+  int npages;    // pages in use, at most TMPPAGES
+} tmpfs;
+
+// Allocate a zeroed page for tmpfs, or return 0.
+static char*
+tmpalloc(void)
+{
+  char *p;
+
+  acquire(&tmpfs.lock);
+  if(tmpfs.npages >= TMPPAGES){
+    release(&tmpfs.lock);
+    return 0;
+  }
+  tmpfs.npages++;
+  release(&tmpfs.lock);
+  if((p = kalloc()) == 0){
+    acquire(&tmpfs.lock);
+    tmpfs.npages--;
+    release(&tmpfs.lock);
+    return 0;
+  }
+  memset(p, 0, PGSIZE);
+  return p;
+}
+
+static void
+tmpfree(char *p)
+{
+  kfree(p);
+  acquire(&tmpfs.lock);
+  tmpfs.npages--;
+  release(&tmpfs.lock);
+}
+
+// Return page pn of t's content, allocating it if alloc
+// is set, or 0.
+static char*
+tmppage(struct tnode *t, uint pn, int alloc)
+{
+  if(pn >= NPTR)
+    return 0;
+  if(t->pages == 0){
+    if(!alloc || (t->pages = (char**)tmpalloc()) == 0)
+      return 0;
+  }
+  if(t->pages[pn] == 0 && alloc)
+    t->pages[pn] = tmpalloc();
+  return t->pages[pn];
+}
+
+// Create the root directory.
+void
+tmpinit(void)
+{
+  struct tnode *t;
+  struct dirent *de;
+
+  initlock(&tmpfs.lock, "tmpfs");
+  t = &tmpfs.tnode[ROOTINO];
+  t->type = T_DIR;
+  t->nlink = 1;
+  t->size = 2*sizeof(*de);
+  if((de = (struct dirent*)tmppage(t, 0, 1)) == 0)
+    panic("tmpinit");
+  de[0].inum = ROOTINO;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  strncpy(de[1].name, "..", DIRSIZ);
+}
+
+// Allocate a tnode of the given type.
+// Returns its inode number, or 0 if there is none free.
+uint
+tmpialloc(short type)
+{
+  uint inum;
+  struct tnode *t;
+
+  acquire(&tmpfs.lock);
+  for(inum = 1; inum < NTMPINODE; inum++){
+    t = &tmpfs.tnode[inum];
+    if(t->type == 0){
+      memset(t, 0, sizeof(*t));
+      t->type = type;
+      release(&tmpfs.lock);
+      return inum;
+    }
+  }
+  release(&tmpfs.lock);
+  printf("tmpialloc: no inodes\n");
+  return 0;
+}
+
+// Copy ip's tnode to the in-memory inode, for ilock().
+void
+tmpiload(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.tnode[ip->inum];
+
+  ip->type = t->type;
+  ip->major = t->major;
+  ip->minor = t->minor;
+  ip->nlink = t->nlink;
+  ip->size = t->size;
+  ip->flags = 0;
+}
+
+// Copy a modified in-memory inode to its tnode, freeing
+// the tnode if the inode has been freed.
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.tnode[ip->inum];
+
+  t->major = ip->major;
+  t->minor = ip->minor;
+  t->nlink = ip->nlink;
+  t->size = ip->size;
+  acquire(&tmpfs.lock);
+  t->type = ip->type;
+  release(&tmpfs.lock);
+}
+
+// Free ip's content.
+void
+tmpitrunc(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.tnode[ip->inum];
+  int i;
+
+  if(t->pages){
+    for(i = 0; i < NPTR; i++){
+      if(t->pages[i])
+        tmpfree(t->pages[i]);
+    }
+    tmpfree((char*)t->pages);
+    t->pages = 0;
+  }
+  ip->size = t->size = 0;
+}
+
+// Read up to n bytes at off from ip into uio, like readiu().
+int
+tmpread(struct inode *ip, struct uio *uio, uint off, uint n)
+{
+  struct tnode *t = &tmpfs.tnode[ip->inum];
+  uint tot, m;
+  char *p;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot = 0; tot < n; tot += m, off += m){
+    if((p = tmppage(t, off/PGSIZE, 0)) == 0)
+      panic("tmpread: hole");
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(uiomove(p + off%PGSIZE, m, UIO_READ, uio) == -1)
+      return -1;
+  }
+  return n;
+}
+
+// Write n bytes from uio to ip at off, like writeiu().
+// Returns the number of bytes written.
+int
+tmpwrite(struct inode *ip, struct uio *uio, uint off, uint n)
+{
+  struct tnode *t = &tmpfs.tnode[ip->inum];
+  uint tot, m;
+  char *p;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > NPTR*PGSIZE)
+    return -1;
+
+  for(tot = 0; tot < n; tot += m, off += m){
+    if((p = tmppage(t, off/PGSIZE, 1)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(uiomove(p + off%PGSIZE, m, UIO_WRITE, uio) == -1)
+      break;
+  }
+  if(off > ip->size)
+    ip->size = t->size = off;
+  return tot;
+}
+
+// Return a pointer to the directory entry at off in dp,
+// which must be below dp->size. The entry may be changed
+// in place.
+struct dirent*
+tmpdirent(struct inode *dp, uint off)
+{
+  char *p;
+
+  if((p = tmppage(&tmpfs.tnode[dp->inum], off/PGSIZE, 0)) == 0)
+    panic("tmpdirent: hole");
+  return (struct dirent*)(p + off%PGSIZE);
+}
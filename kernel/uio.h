@@ -0,0 +1,17 @@
+// Describes a data transfer between the kernel and a list of
+// buffers (struct iovec), in user or kernel memory. uiomove()
+// advances through the buffers as it copies, and remembers
+// the last user page it translated, so that a transfer made
+// in small pieces walks the page table once per page.
+
+#define UIO_READ   0   // copy to the buffers
+#define UIO_WRITE  1   // copy from the buffers
+
+struct uio {
+  struct iovec *iov;      // current buffer
+  int iovcnt;             // buffers left, counting iov
+  uint64 resid;           // bytes left in all buffers
+  pagetable_t pagetable;  // user page table, or 0 for kernel buffers
+  uint64 va0;             // last user page translated
+  uint64 pa0;             // its physical address, or 0
+};
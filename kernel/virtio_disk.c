@@ -150,6 +150,10 @@ virtio_disk_init(void)
   *R(VIRTIO_MMIO_STATUS) = status;
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+
+  // each request uses three descriptors.
+  bdevsw[ROOTDEV].rw = virtio_disk_rw;
+  bdevsw[ROOTDEV].depth = NUM / 3;
 }
 
 // find a free descriptor, mark it non-free, return its index.
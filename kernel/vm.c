@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "iovec.h"
+#include "uio.h"
 
 /*
  * the kernel's page table.
@@ -395,6 +397,72 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Set up uio to transfer to or from the iovcnt buffers in iov,
+// which are user addresses in pagetable, or kernel addresses
+// if pagetable is 0. The transfer updates iov[] in place.
+void
+uioinit(struct uio *uio, struct iovec *iov, int iovcnt, pagetable_t pagetable)
+{
+  int i;
+
+  uio->iov = iov;
+  uio->iovcnt = iovcnt;
+  uio->resid = 0;
+  for(i = 0; i < iovcnt; i++)
+    uio->resid += iov[i].iov_len;
+  uio->pagetable = pagetable;
+  uio->va0 = 0;
+  uio->pa0 = 0;
+}
+
+// Copy n bytes between kernel address kaddr and the next
+// bytes of uio's buffers: to the buffers if rw is UIO_READ,
+// from them if UIO_WRITE. Copies less if the buffers run out.
+// Return 0 on success, -1 on a bad user address.
+int
+uiomove(void *kaddr, uint64 n, int rw, struct uio *uio)
+{
+  char *k, *p;
+  uint64 m, va, pa;
+
+  k = kaddr;
+  while(n > 0 && uio->resid > 0){
+    if(uio->iov->iov_len == 0){
+      uio->iov++;
+      uio->iovcnt--;
+      continue;
+    }
+    va = (uint64)uio->iov->iov_base;
+    m = uio->iov->iov_len;
+    if(m > n)
+      m = n;
+    if(uio->pagetable){
+      if(uio->pa0 == 0 || PGROUNDDOWN(va) != uio->va0){
+        if((pa = walkaddr(uio->pagetable, PGROUNDDOWN(va))) == 0)
+          return -1;
+        uio->va0 = PGROUNDDOWN(va);
+        uio->pa0 = pa;
+      }
+      if(m > PGSIZE - (va - uio->va0))
+        m = PGSIZE - (va - uio->va0);
+      p = (char*)(uio->pa0 + (va - uio->va0));
+    } else {
+      p = (char*)va;
+    }
+    if(rw == UIO_READ)
+      memmove(p, k, m);
+    else
+      memmove(k, p, m);
+
+    k += m;
+    n -= m;
+    uio->iov->iov_base = (char*)uio->iov->iov_base + m;
+    uio->iov->iov_len -= m;
+    uio->resid -= m;
+  }
+  return 0;
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
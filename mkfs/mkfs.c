@@ -22,7 +22,8 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+// The log gets a tenth of the disk, up to the kernel's LOGSIZE.
+int nlog = FSSIZE/10 < LOGSIZE ? FSSIZE/10 : LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -39,7 +40,10 @@ void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
+uint ientry(uint *ap, uint i);
 void iappend(uint inum, void *p, int n);
+void bappend(uint inum, void *p, int n);
+void dirindex(uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -83,6 +87,7 @@ main(int argc, char *argv[])
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert(sizeof(struct dinode) == 16 + NINLINE);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
@@ -167,6 +172,8 @@ main(int argc, char *argv[])
   din.size = xint(off);
   winode(rootino, &din);
 
+  dirindex(rootino);
+
   balloc(freeblock);
 
   exit(0);
@@ -249,15 +256,64 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block number in entry i of the indirect
+// block *ap, allocating the indirect block and the entry
+// if they are zero. *ap is in disk byte order.
+uint
+ientry(uint *ap, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  if(xint(*ap) == 0){
+    *ap = xint(freeblock++);
+  }
+  rsect(xint(*ap), (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(xint(*ap), (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
+// Append to inode inum. A regular file's content stays in the
+// inode while it fits, as in the kernel's writei().
 void
 iappend(uint inum, void *xp, int n)
+{
+  struct dinode din;
+  uint off;
+  char saved[NINLINE];
+
+  rinode(inum, &din);
+  off = xint(din.size);
+  if(din.type == xshort(T_FILE) && (off == 0 || (xint(din.flags) & DI_INLINE))){
+    if(off + n <= NINLINE){
+      bcopy(xp, din.data + off, n);
+      din.flags = xint(DI_INLINE);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // Too big to stay inline: move the content to blocks.
+    bcopy(din.data, saved, off);
+    bzero(din.data, sizeof(din.data));
+    din.flags = 0;
+    din.size = 0;
+    winode(inum, &din);
+    bappend(inum, saved, off);
+  }
+  bappend(inum, xp, n);
+}
+
+// Append to inode inum's blocks.
+void
+bappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -270,16 +326,13 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = ientry(&din.addrs[NDIRECT], fbn - NDIRECT);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      fbn -= NDIRECT + NINDIRECT;
+      ind = xint(ientry(&din.addrs[NDIRECT+1], fbn / NINDIRECT));
+      x = ientry(&ind, fbn % NINDIRECT);
+      fbn += NDIRECT + NINDIRECT;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -293,6 +346,109 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Disk block holding block fbn of inode din, which must exist.
+uint
+fblock(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+
+  if(fbn < NDIRECT)
+    return xint(din->addrs[fbn]);
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT){
+    rsect(xint(din->addrs[NDIRECT]), (char*)indirect);
+    return xint(indirect[fbn]);
+  }
+  fbn -= NINDIRECT;
+  rsect(xint(din->addrs[NDIRECT+1]), (char*)indirect);
+  rsect(xint(indirect[fbn / NINDIRECT]), (char*)indirect);
+  return xint(indirect[fbn % NINDIRECT]);
+}
+
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a, as in kernel/fs.c
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+void
+dirhput(uchar *blk, int k, int n, uint v)
+{
+  for(; n > 0; n--, k++, v >>= 8)
+    blk[DIRHOFF(k)] = v & 0xff;
+}
+
+// If directory inum has outgrown DIRHASHBLK blocks, rewrite
+// it as a hashed directory (see fs.h). Unlike the kernel,
+// give every hash value its own leaf.
+void
+dirindex(uint inum)
+{
+  struct dinode din;
+  struct dirent *all, *de;
+  uchar blk[BSIZE];
+  uint nblk, n, b, i, j, gd, cnt[1 << DIRHMAXDEPTH];
+
+  rinode(inum, &din);
+  nblk = xint(din.size) / BSIZE;
+  if(nblk <= DIRHASHBLK)
+    return;
+
+  all = malloc(nblk * BSIZE);
+  n = 0;
+  for(b = 0; b < nblk; b++){
+    rsect(fblock(&din, b), blk);
+    de = (struct dirent*)blk;
+    for(i = b == 0 ? 2 : 0; i < DPB; i++){
+      if(de[i].inum != 0)
+        all[n++] = de[i];
+    }
+  }
+
+  // Use the fewest hash bits that fit each leaf in a block.
+  for(gd = 0; ; gd++){
+    assert(gd <= DIRHMAXDEPTH);
+    memset(cnt, 0, sizeof(cnt));
+    for(i = 0; i < n; i++)
+      cnt[dirhash(all[i].name) & ((1 << gd) - 1)]++;
+    for(j = 0; j < (1 << gd) && cnt[j] <= DPB; j++)
+      ;
+    if(j == (1 << gd))
+      break;
+  }
+  for(; nblk < (1 << gd) + 1; nblk++)
+    iappend(inum, zeroes, BSIZE);
+  rinode(inum, &din);
+
+  rsect(fblock(&din, 0), blk);
+  memset(blk + 2*sizeof(struct dirent), 0, BSIZE - 2*sizeof(struct dirent));
+  dirhput(blk, DIRH_MAGIC, 4, DIRHMAGIC);
+  dirhput(blk, DIRH_DEPTH, 1, gd);
+  dirhput(blk, DIRH_NLEAF, 2, 1 << gd);
+  for(j = 0; j < (1 << gd); j++)
+    dirhput(blk, DIRH_INDEX + 2*j, 2, j + 1);
+  wsect(fblock(&din, 0), blk);
+
+  for(b = 1; b < nblk; b++){
+    memset(blk, 0, BSIZE);
+    de = (struct dirent*)blk;
+    for(i = 0, j = 0; i < n; i++){
+      if(b <= (1 << gd) && (dirhash(all[i].name) & ((1 << gd) - 1)) == b - 1)
+        de[j++] = all[i];
+    }
+    wsect(fblock(&din, b), blk);
+  }
+  free(all);
+}
+
 void
 die(const char *s)
 {
@@ -1,6 +1,7 @@
 // init: The initial user-level program
 
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/stat.h"
 #include "kernel/spinlock.h"
 #include "kernel/sleeplock.h"
@@ -24,6 +25,11 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // temporary files live in memory.
+  mkdir("/tmp");
+  if(mount("/tmp", TMPDEV) < 0)
+    printf("init: cannot mount /tmp\n");
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
@@ -0,0 +1,36 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockinfo info[NLOCKCLASS];
+
+// Print the lock classes that spent the most time waiting,
+// most first. lockstat n prints the top n (default 15).
+int
+main(int argc, char *argv[])
+{
+  struct lockinfo t;
+  int i, j, n, top;
+
+  top = argc > 1 ? atoi(argv[1]) : 15;
+  if((n = lockstat(info, NLOCKCLASS)) < 0){
+    fprintf(2, "lockstat: failed\n");
+    exit(1);
+  }
+
+  // insertion sort by wait time, largest first.
+  for(i = 1; i < n; i++){
+    t = info[i];
+    for(j = i; j > 0 && info[j-1].wait < t.wait; j--)
+      info[j] = info[j-1];
+    info[j] = t;
+  }
+
+  printf("name kind acquired contended wait maxhold\n");
+  for(i = 0; i < n && i < top; i++){
+    printf("%s %s %l %l %l %l\n", info[i].name, info[i].sleep ? "sleep" : "spin",
+           info[i].nacquire, info[i].ncontend, info[i].wait, info[i].maxhold);
+  }
+  exit(0);
+}
@@ -0,0 +1,35 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/logstat.h"
+#include "user/user.h"
+
+// Print the file system log's size and counters.
+// logstat sync|relaxed first switches the commit mode.
+int
+main(int argc, char *argv[])
+{
+  struct logstat st;
+
+  if(argc > 1){
+    if(strcmp(argv[1], "sync") == 0)
+      logmode(LOG_SYNC);
+    else if(strcmp(argv[1], "relaxed") == 0)
+      logmode(LOG_RELAXED);
+    else {
+      fprintf(2, "usage: logstat [sync|relaxed]\n");
+      exit(1);
+    }
+  }
+  if(logstat(&st) < 0){
+    fprintf(2, "logstat: failed\n");
+    exit(1);
+  }
+  printf("log: %d blocks, %d per transaction, %s commits\n", st.size, st.capacity,
+         st.mode == LOG_RELAXED ? "relaxed" : "sync");
+  printf("running transaction: %d blocks, %d reserved\n", st.inuse, st.reserved);
+  printf("log_write: %l, absorbed: %l\n", st.nwrite, st.nabsorb);
+  printf("commits: %l, blocks logged: %l\n", st.ncommit, st.nlogged);
+  printf("begin_op waits: %l, checkpoints: %l\n", st.nwait, st.ncheckpoint);
+  printf("forced commits: %l\n", st.nforce);
+  exit(0);
+}
@@ -6,6 +6,8 @@
 // after about 5 runs of stressfs in QEMU on a 2.1GHz CPU:
 //    for (i = 0; i < 40000; i++)
 //      asm volatile("");
+//
+// The files are temporary, so they live in /tmp, in memory.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
@@ -17,7 +19,7 @@ int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char path[] = "stressfs0";
+  char path[] = "/tmp/stressfs0";
   char data[512];
 
   printf("stressfs starting\n");
@@ -29,7 +31,7 @@ main(int argc, char *argv[])
 
   printf("write %d\n", i);
 
-  path[8] += i;
+  path[13] += i;
   fd = open(path, O_CREATE | O_RDWR);
   for(i = 0; i < 20; i++)
 //    printf(fd, "%d\n", i);
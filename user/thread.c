@@ -0,0 +1,167 @@
+// User-level threads, on clone() and join().
+//
+// A thread shares its process's memory, and runs on a stack
+// of one page that thread_create() allocates and
+// thread_join() frees. malloc() and free() are not
+// thread-safe, so threads must not call them while others
+// might: the library itself serializes its own calls with
+// a lock.
+//
+// Mutexes and condition variables sleep in the kernel, with
+// futex_wait(), only when they have to wait.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+static lock_t alloclock;
+
+// The start of every thread: run fn(arg), then exit.
+static void
+threadstart(void *fn, void *arg)
+{
+  ((void (*)(void*))fn)(arg);
+  exit(0);
+}
+
+// Start fn(arg) in a new thread.
+// Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  lock_acquire(&alloclock);
+  stack = malloc(PGSIZE);
+  lock_release(&alloclock);
+  if(stack == 0)
+    return -1;
+  if((pid = clone(threadstart, (void*)fn, arg, stack)) < 0){
+    lock_acquire(&alloclock);
+    free(stack);
+    lock_release(&alloclock);
+  }
+  return pid;
+}
+
+// Wait for one of the process's threads to finish.
+// Returns its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) < 0)
+    return -1;
+  lock_acquire(&alloclock);
+  free(stack);
+  lock_release(&alloclock);
+  return pid;
+}
+
+// Spin locks.
+
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+lock_release(lock_t *lk)
+{
+  __sync_synchronize();
+  __sync_lock_release(&lk->locked);
+}
+
+// Mutexes.
+//
+// m->state is 0 if m is unlocked, 1 if it is locked, and 2
+// if it is locked and others may be waiting for it, so only
+// an unlock from state 2 has to call futex_wake().
+
+#define MUTEXSPIN 100  // tries before sleeping in the kernel
+
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  int i, c;
+
+  // The holder is probably running, and will let go soon.
+  for(i = 0; i < MUTEXSPIN; i++){
+    if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+      return;
+  }
+  // Say there is a waiter, and sleep until m is unlocked.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// Condition variables.
+//
+// c->seq changes at every signal, so a waiter that goes to
+// sleep after one does not wait for the next.
+
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+// Wait for c to be signalled. m must be locked, and is
+// again on return.
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  // Others may be waiting for m too.
+  while(__sync_lock_test_and_set(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, NPROC);
+}
@@ -1,4 +1,8 @@
 struct stat;
+struct logstat;
+struct lockinfo;
+struct iovec;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -28,6 +32,28 @@ int sigalarm(int ticks, void (*handler)());
 int sigreturn(void);
 void trace(int);//argument is mask
 void settickets(int);
+int logstat(struct logstat*);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int fsync(int);
+int fdatasync(int);
+int logmode(int);
+int mount(const char*, int);
+int umount(const char*);
+int lockstat(struct lockinfo*, int);
+int clone(void (*)(void*, void*), void*, void*, void*);
+int join(void**);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int shmcreate(const char*, int);
+void* shmattach(int);
+int shmdetach(void*);
+int shmremove(const char*);
+int poll(struct pollfd*, int, int);
+int fcntl(int, int, int);
+int pipe2(int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -45,3 +71,26 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// thread.c
+typedef struct {
+  uint locked;
+} lock_t;
+int thread_create(void (*)(void*), void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+typedef struct {
+  int state;
+} mutex_t;
+typedef struct {
+  int seq;
+} cond_t;
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/iovec.h"
+#include "kernel/logstat.h"
+#include "kernel/lockstat.h"
+#include "kernel/poll.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -575,10 +579,295 @@ writetest(char *s)
   }
 }
 
+// files under /tmp live in tmpfs, and writing them
+// does not go through the log.
+void
+tmpfsfile(char *s)
+{
+  struct logstat st0, st1;
+  struct stat st;
+  int fd, i, n;
+
+  unlink("/tmp/tmpfsdir/f");
+  unlink("/tmp/tmpfsdir");
+  if(mkdir("/tmp/tmpfsdir") < 0){
+    printf("%s: mkdir /tmp/tmpfsdir failed\n", s);
+    exit(1);
+  }
+  fd = open("/tmp/tmpfsdir/f", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create /tmp/tmpfsdir/f\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.dev != TMPDEV){
+    printf("%s: /tmp is not tmpfs\n", s);
+    exit(1);
+  }
+  n = 3*PGSIZE + 100;
+  for(i = 0; i < n; i++)
+    buf[i] = i % 251;
+  logstat(&st0);
+  if(write(fd, buf, n) != n){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  logstat(&st1);
+  if(st1.nwrite != st0.nwrite){
+    printf("%s: tmpfs write went through the log\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("/tmp/tmpfsdir/f", O_RDONLY);
+  memset(buf, 0, n);
+  if(read(fd, buf, n + 1) != n){
+    printf("%s: read back failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < n; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  if(unlink("/tmp/tmpfsdir") == 0){
+    printf("%s: removed a non-empty directory\n", s);
+    exit(1);
+  }
+  if(link("/tmp/tmpfsdir/f", "tmpfslink") == 0){
+    printf("%s: linked across file systems\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tmpfsdir/f") < 0 || unlink("/tmp/tmpfsdir") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("/tmp/tmpfsdir/f", O_RDONLY) >= 0){
+    printf("%s: file survived unlink\n", s);
+    exit(1);
+  }
+}
+
+// mount the RAM disk on a directory, use it, and unmount it.
+void
+mountfs(char *s)
+{
+  struct stat st, root;
+  int fd;
+
+  unlink("mountfs");
+  if(mkdir("mountfs") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if(mount("mountfs", RAMDEV) < 0){
+    printf("%s: mount failed\n", s);
+    exit(1);
+  }
+  if(mount("mountfs", RAMDEV) == 0){
+    printf("%s: mounted the RAM disk twice\n", s);
+    exit(1);
+  }
+  fd = open("mountfs/file", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "ram", 3) != 3){
+    printf("%s: cannot write mountfs/file\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.dev != RAMDEV){
+    printf("%s: mountfs/file is not on the RAM disk\n", s);
+    exit(1);
+  }
+  if(stat("mountfs/..", &st) < 0 || stat("/", &root) < 0 ||
+     st.dev != root.dev || st.ino != root.ino){
+    printf("%s: .. of the mounted root is wrong\n", s);
+    exit(1);
+  }
+  if(unlink("mountfs") == 0){
+    printf("%s: unlinked a mount point\n", s);
+    exit(1);
+  }
+  if(umount("mountfs") == 0){
+    printf("%s: unmounted a busy file system\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("mountfs/file") < 0){
+    printf("%s: unlink mountfs/file failed\n", s);
+    exit(1);
+  }
+  if(umount("mountfs") < 0){
+    printf("%s: umount failed\n", s);
+    exit(1);
+  }
+  if(stat("mountfs", &st) < 0 || st.dev != ROOTDEV){
+    printf("%s: mount point still covered\n", s);
+    exit(1);
+  }
+  if(unlink("mountfs") < 0){
+    printf("%s: unlink mountfs failed\n", s);
+    exit(1);
+  }
+}
+
+// grow a directory past DIRHASHBLK blocks, so that it is
+// turned into a hashed directory, and check that every name
+// can still be found, read back, and removed.
+void
+hashdir(char *s)
+{
+  enum { N = 300 };
+  int i, fd, n;
+  char name[16];
+  struct dirent de;
+
+  unlink("hd/f");
+  unlink("hd");
+  if(mkdir("hd") != 0 || (fd = open("hd/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create hd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  strcpy(name, "hd/x00");
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 64;
+    name[5] = '0' + i % 64;
+    if(link("hd/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 64;
+    name[5] = '0' + i % 64;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  // ".", "..", "f" and the links; the index reads as free entries.
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum != 0)
+      n++;
+  }
+  close(fd);
+  if(n != N + 3){
+    printf("%s: read %d entries, expected %d\n", s, n, N + 3);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i / 64;
+    name[5] = '0' + i % 64;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(open("hd/x00", O_RDONLY) >= 0){
+    printf("%s: hd/x00 still there\n", s);
+    exit(1);
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// open path n times, checking that it opens every time to a
+// file whose first byte is c, or, if c is 0, that it never does.
+static void
+ncopen(char *s, char *path, char c, int n)
+{
+  int fd;
+  char got;
+
+  for(; n > 0; n--){
+    fd = open(path, O_RDONLY);
+    if(c == 0){
+      if(fd >= 0){
+        printf("%s: %s still there\n", s, path);
+        exit(1);
+      }
+      continue;
+    }
+    if(fd < 0 || read(fd, &got, 1) != 1 || got != c){
+      printf("%s: %s is not the file written as '%c'\n", s, path, c);
+      exit(1);
+    }
+    close(fd);
+  }
+}
+
+static void
+ncwrite(char *s, char *path, char c)
+{
+  int fd;
+
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0 || write(fd, &c, 1) != 1){
+    printf("%s: create %s failed\n", s, path);
+    exit(1);
+  }
+  close(fd);
+}
+
+// the name cache forgets lookups that creates, unlinks and
+// links make stale. each name is opened repeatedly, so the
+// later opens come from the cache.
+void
+namecache(char *s)
+{
+  unlink("nc/f");
+  unlink("nc/a");
+  unlink("nc/b");
+  unlink("nc");
+  if(mkdir("nc") != 0){
+    printf("%s: mkdir nc failed\n", s);
+    exit(1);
+  }
+
+  // a negative entry gives way to the created file.
+  ncopen(s, "nc/f", 0, 3);
+  ncwrite(s, "nc/f", 'f');
+  ncopen(s, "nc/f", 'f', 3);
+
+  // a positive entry turns negative after unlink.
+  if(unlink("nc/f") != 0){
+    printf("%s: unlink nc/f failed\n", s);
+    exit(1);
+  }
+  ncopen(s, "nc/f", 0, 3);
+
+  // renaming a over b, as link and unlink, finds a's inode at b.
+  ncwrite(s, "nc/a", 'a');
+  ncwrite(s, "nc/b", 'b');
+  ncopen(s, "nc/a", 'a', 3);
+  ncopen(s, "nc/b", 'b', 3);
+  if(unlink("nc/b") != 0 || link("nc/a", "nc/b") != 0 || unlink("nc/a") != 0){
+    printf("%s: rename of nc/a to nc/b failed\n", s);
+    exit(1);
+  }
+  ncopen(s, "nc/b", 'a', 3);
+  ncopen(s, "nc/a", 0, 3);
+
+  if(unlink("nc/b") != 0 || unlink("nc") != 0){
+    printf("%s: unlink nc failed\n", s);
+    exit(1);
+  }
+}
+
+// write a file that reaches into the double-indirect blocks.
 void
 writebig(char *s)
 {
   int i, fd, n;
+  int nblocks = NDIRECT + NINDIRECT + 2*NINDIRECT;
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -586,7 +875,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < nblocks; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +895,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != nblocks){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1500,228 +1789,1077 @@ linkunlink(char *s)
     exit(1);
   }
 
-  unsigned int x = (pid ? 1 : 97);
-  for(i = 0; i < 100; i++){
-    x = x * 1103515245 + 12345;
-    if((x % 3) == 0){
-      close(open("x", O_RDWR | O_CREATE));
-    } else if((x % 3) == 1){
-      link("cat", "x");
-    } else {
-      unlink("x");
+  unsigned int x = (pid ? 1 : 97);
+  for(i = 0; i < 100; i++){
+    x = x * 1103515245 + 12345;
+    if((x % 3) == 0){
+      close(open("x", O_RDWR | O_CREATE));
+    } else if((x % 3) == 1){
+      link("cat", "x");
+    } else {
+      unlink("x");
+    }
+  }
+
+  if(pid)
+    wait(0);
+  else
+    exit(0);
+}
+
+
+void
+subdir(char *s)
+{
+  int fd, cc;
+
+  unlink("ff");
+  if(mkdir("dd") != 0){
+    printf("%s: mkdir dd failed\n", s);
+    exit(1);
+  }
+
+  fd = open("dd/ff", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create dd/ff failed\n", s);
+    exit(1);
+  }
+  write(fd, "ff", 2);
+  close(fd);
+
+  if(unlink("dd") >= 0){
+    printf("%s: unlink dd (non-empty dir) succeeded!\n", s);
+    exit(1);
+  }
+
+  if(mkdir("/dd/dd") != 0){
+    printf("subdir mkdir dd/dd failed\n", s);
+    exit(1);
+  }
+
+  fd = open("dd/dd/ff", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create dd/dd/ff failed\n", s);
+    exit(1);
+  }
+  write(fd, "FF", 2);
+  close(fd);
+
+  fd = open("dd/dd/../ff", 0);
+  if(fd < 0){
+    printf("%s: open dd/dd/../ff failed\n", s);
+    exit(1);
+  }
+  cc = read(fd, buf, sizeof(buf));
+  if(cc != 2 || buf[0] != 'f'){
+    printf("%s: dd/dd/../ff wrong content\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(link("dd/dd/ff", "dd/dd/ffff") != 0){
+    printf("link dd/dd/ff dd/dd/ffff failed\n", s);
+    exit(1);
+  }
+
+  if(unlink("dd/dd/ff") != 0){
+    printf("%s: unlink dd/dd/ff failed\n", s);
+    exit(1);
+  }
+  if(open("dd/dd/ff", O_RDONLY) >= 0){
+    printf("%s: open (unlinked) dd/dd/ff succeeded\n", s);
+    exit(1);
+  }
+
+  if(chdir("dd") != 0){
+    printf("%s: chdir dd failed\n", s);
+    exit(1);
+  }
+  if(chdir("dd/../../dd") != 0){
+    printf("%s: chdir dd/../../dd failed\n", s);
+    exit(1);
+  }
+  if(chdir("dd/../../../dd") != 0){
+    printf("chdir dd/../../dd failed\n", s);
+    exit(1);
+  }
+  if(chdir("./..") != 0){
+    printf("%s: chdir ./.. failed\n", s);
+    exit(1);
+  }
+
+  fd = open("dd/dd/ffff", 0);
+  if(fd < 0){
+    printf("%s: open dd/dd/ffff failed\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, sizeof(buf)) != 2){
+    printf("%s: read dd/dd/ffff wrong len\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(open("dd/dd/ff", O_RDONLY) >= 0){
+    printf("%s: open (unlinked) dd/dd/ff succeeded!\n", s);
+    exit(1);
+  }
+
+  if(open("dd/ff/ff", O_CREATE|O_RDWR) >= 0){
+    printf("%s: create dd/ff/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(open("dd/xx/ff", O_CREATE|O_RDWR) >= 0){
+    printf("%s: create dd/xx/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(open("dd", O_CREATE) >= 0){
+    printf("%s: create dd succeeded!\n", s);
+    exit(1);
+  }
+  if(open("dd", O_RDWR) >= 0){
+    printf("%s: open dd rdwr succeeded!\n", s);
+    exit(1);
+  }
+  if(open("dd", O_WRONLY) >= 0){
+    printf("%s: open dd wronly succeeded!\n", s);
+    exit(1);
+  }
+  if(link("dd/ff/ff", "dd/dd/xx") == 0){
+    printf("%s: link dd/ff/ff dd/dd/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(link("dd/xx/ff", "dd/dd/xx") == 0){
+    printf("%s: link dd/xx/ff dd/dd/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(link("dd/ff", "dd/dd/ffff") == 0){
+    printf("%s: link dd/ff dd/dd/ffff succeeded!\n", s);
+    exit(1);
+  }
+  if(mkdir("dd/ff/ff") == 0){
+    printf("%s: mkdir dd/ff/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(mkdir("dd/xx/ff") == 0){
+    printf("%s: mkdir dd/xx/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(mkdir("dd/dd/ffff") == 0){
+    printf("%s: mkdir dd/dd/ffff succeeded!\n", s);
+    exit(1);
+  }
+  if(unlink("dd/xx/ff") == 0){
+    printf("%s: unlink dd/xx/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(unlink("dd/ff/ff") == 0){
+    printf("%s: unlink dd/ff/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(chdir("dd/ff") == 0){
+    printf("%s: chdir dd/ff succeeded!\n", s);
+    exit(1);
+  }
+  if(chdir("dd/xx") == 0){
+    printf("%s: chdir dd/xx succeeded!\n", s);
+    exit(1);
+  }
+
+  if(unlink("dd/dd/ffff") != 0){
+    printf("%s: unlink dd/dd/ff failed\n", s);
+    exit(1);
+  }
+  if(unlink("dd/ff") != 0){
+    printf("%s: unlink dd/ff failed\n", s);
+    exit(1);
+  }
+  if(unlink("dd") == 0){
+    printf("%s: unlink non-empty dd succeeded!\n", s);
+    exit(1);
+  }
+  if(unlink("dd/dd") < 0){
+    printf("%s: unlink dd/dd failed\n", s);
+    exit(1);
+  }
+  if(unlink("dd") < 0){
+    printf("%s: unlink dd failed\n", s);
+    exit(1);
+  }
+}
+
+// test writes that are larger than the log.
+void
+bigwrite(char *s)
+{
+  int fd, sz;
+
+  unlink("bigwrite");
+  for(sz = 499; sz < (MAXOPBLOCKS+2)*BSIZE; sz += 471){
+    fd = open("bigwrite", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create bigwrite\n", s);
+      exit(1);
+    }
+    int i;
+    for(i = 0; i < 2; i++){
+      int cc = write(fd, buf, sz);
+      if(cc != sz){
+        printf("%s: write(%d) ret %d\n", s, sz, cc);
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink("bigwrite");
+  }
+}
+
+// small files live in the inode until they grow too big;
+// check the content survives the move to a block.
+void
+inlinefile(char *s)
+{
+  int fd, i, n;
+
+  unlink("inlinefile");
+  fd = open("inlinefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create inlinefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 100; i++){
+    buf[0] = 'a' + i % 26;
+    if(write(fd, buf, 1) != 1){
+      printf("%s: write %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // append enough to move the content out of the inode.
+  fd = open("inlinefile", O_RDWR);
+  n = read(fd, buf, sizeof(buf));
+  if(n != 100){
+    printf("%s: read %d bytes, expected 100\n", s, n);
+    exit(1);
+  }
+  memset(buf, 'z', 2*BSIZE);
+  if(write(fd, buf, 2*BSIZE) != 2*BSIZE){
+    printf("%s: append failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("inlinefile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 100 + 2*BSIZE){
+    printf("%s: read %d bytes after append\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(buf[i] != (i < 100 ? 'a' + i % 26 : 'z')){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("inlinefile");
+}
+
+// a large overwrite should commit as one transaction (or a
+// few), not one per handful of blocks.
+void
+bigtxwrite(char *s)
+{
+  struct logstat st0, st1;
+  int fd, i, n;
+
+  n = MAXOPBLOCKS * BSIZE;
+  unlink("bigtxwrite");
+  for(i = 0; i < 2; i++){
+    // the first pass allocates the blocks, the second
+    // overwrites them in place through the log.
+    fd = open("bigtxwrite", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create bigtxwrite\n", s);
+      exit(1);
+    }
+    memset(buf, 'a' + i, n);
+    if(logstat(&st0) < 0){
+      printf("%s: logstat failed\n", s);
+      exit(1);
+    }
+    if(write(fd, buf, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(logstat(&st1) < 0){
+      printf("%s: logstat failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  if(st1.ncommit - st0.ncommit > 2){
+    printf("%s: %d commits for one write\n", s, (int)(st1.ncommit - st0.ncommit));
+    exit(1);
+  }
+
+  fd = open("bigtxwrite", O_RDONLY);
+  if(read(fd, buf, n) != n || buf[0] != 'b' || buf[n-1] != 'b'){
+    printf("%s: read back failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("bigtxwrite");
+}
+
+// in relaxed log mode, FS calls share one transaction
+// until fsync() commits it.
+void
+relaxedlog(char *s)
+{
+  struct logstat st0, st1;
+  int fd, i, old;
+
+  if((old = logmode(LOG_RELAXED)) < 0){
+    printf("%s: logmode failed\n", s);
+    exit(1);
+  }
+  unlink("relaxedlog");
+  logstat(&st0);
+  fd = open("relaxedlog", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create relaxedlog\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 8; i++){
+    if(write(fd, "relaxed", 7) != 7){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  logstat(&st1);
+  // the committer thread may have run once in between.
+  if(st1.ncommit - st0.ncommit > 1){
+    printf("%s: writes were committed one by one\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  logstat(&st1);
+  if(st1.inuse != 0 || st1.nforce - st0.nforce != 2){
+    printf("%s: fsync did not commit\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("relaxedlog");
+  logmode(old);
+
+  if(logmode(7) != -1){
+    printf("%s: logmode accepted a bad mode\n", s);
+    exit(1);
+  }
+}
+
+// lockstat() reports counters for the locks in use.
+void
+lockstats(char *s)
+{
+  static struct lockinfo info[NLOCKCLASS];
+  int i, n, fd;
+  uint64 before;
+
+  n = lockstat(info, NLOCKCLASS);
+  for(i = 0; i < n && strcmp(info[i].name, "bcache") != 0; i++)
+    ;
+  if(i == n || info[i].sleep){
+    printf("%s: no bcache lock class\n", s);
+    exit(1);
+  }
+  before = info[i].nacquire;
+  fd = open("README", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 10) != 10){
+    printf("%s: cannot read README\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(lockstat(info, i+1) != i+1 || info[i].nacquire <= before){
+    printf("%s: bcache acquisitions not counted\n", s);
+    exit(1);
+  }
+  if(lockstat(info, 0) != 0){
+    printf("%s: lockstat copied too much\n", s);
+    exit(1);
+  }
+}
+
+// path lookups and preads of the same directory and file,
+// which share the inode locks, alongside a process changing
+// the directory.
+void
+sharedread(char *s)
+{
+  enum { NCHILD = 4, N = 100 };
+  char name[16], data[16];
+  struct stat st;
+  int i, j, fd, pid, xstatus;
+
+  unlink("srd/f");
+  unlink("srd");
+  if(mkdir("srd") < 0 || (fd = open("srd/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: cannot make srd/f\n", s);
+    exit(1);
+  }
+  if(write(fd, "0123456789", 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < N; j++){
+        if(i == 0){
+          // the writer: add and remove names in srd.
+          strcpy(name, "srd/a");
+          name[4] += j % 26;
+          if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+            printf("%s: create %s failed\n", s, name);
+            exit(1);
+          }
+          close(fd);
+          if(unlink(name) < 0){
+            printf("%s: unlink %s failed\n", s, name);
+            exit(1);
+          }
+          continue;
+        }
+        if(stat("srd/f", &st) < 0 || st.size != 10){
+          printf("%s: stat srd/f failed\n", s);
+          exit(1);
+        }
+        if((fd = open("srd/f", O_RDONLY)) < 0 ||
+           pread(fd, data, 4, 3) != 4 || memcmp(data, "3456", 4) != 0){
+          printf("%s: pread srd/f failed\n", s);
+          exit(1);
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+
+  // pids are not reused, so there is no such process.
+  if(kill(pid + 1000) != -1){
+    printf("%s: kill of a missing pid succeeded\n", s);
+    exit(1);
+  }
+  unlink("srd/f");
+  unlink("srd");
+}
+
+static lock_t tlock;
+static volatile int tcount;
+static char * volatile tmem;
+
+static void
+tadd(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    lock_acquire(&tlock);
+    tcount++;
+    lock_release(&tlock);
+  }
+  if(arg)
+    tmem = sbrk(PGSIZE);
+}
+
+static void
+tspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// threads share memory, and go away with their process.
+void
+threads(char *s)
+{
+  enum { NTHREAD = 4 };
+  int i, pid, xstatus;
+
+  lock_init(&tlock);
+  tcount = 0;
+  tmem = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(tadd, i == 0 ? (void*)1 : 0) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(thread_join() != -1){
+    printf("%s: joined a thread that was not there\n", s);
+    exit(1);
+  }
+  if(tcount != NTHREAD * 1000){
+    printf("%s: count %d, not %d\n", s, tcount, NTHREAD * 1000);
+    exit(1);
+  }
+  // memory a thread allocated is ours too.
+  if(tmem == (char*)-1 || tmem == 0){
+    printf("%s: sbrk in a thread failed\n", s);
+    exit(1);
+  }
+  tmem[PGSIZE-1] = 1;
+
+  // a process that exits takes its running threads along.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(thread_create(tspin, 0) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: thread_create in child failed\n", s);
+    exit(1);
+  }
+}
+
+static volatile int tforks, tshrinks;
+
+static void
+tfork(void *arg)
+{
+  int i, pid, xstatus;
+
+  for(i = 0; i < 20; i++){
+    if((pid = fork()) < 0)
+      break;
+    if(pid == 0)
+      exit(0);
+    wait(&xstatus);
+    tforks++;
+  }
+}
+
+static void
+tshrink(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 20; i++){
+    if(sbrk(-PGSIZE) != (char*)-1)
+      tshrinks++;
+  }
+}
+
+// a thread may not shrink the memory its siblings share,
+// for instance while one of them is fork()ing.
+void
+threadshrink(char *s)
+{
+  char *a;
+
+  if((a = sbrk(20*PGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a[20*PGSIZE-1] = 1;
+  tforks = tshrinks = 0;
+  if(thread_create(tfork, 0) < 0 || thread_create(tshrink, 0) < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  thread_join();
+  thread_join();
+  if(tforks != 20 || tshrinks != 0){
+    printf("%s: %d forks, %d shrinks\n", s, tforks, tshrinks);
+    exit(1);
+  }
+  // with no threads left, shrinking is fine again.
+  a = sbrk(PGSIZE);
+  if(a == (char*)-1 || sbrk(-PGSIZE) != a + PGSIZE){
+    printf("%s: sbrk(-n) failed\n", s);
+    exit(1);
+  }
+}
+
+static mutex_t fmutex;
+static cond_t fcond;
+static volatile int fcount, fitems;
+
+static void
+fworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&fmutex);
+    fcount++;
+    mutex_unlock(&fmutex);
+  }
+  // consume an item.
+  mutex_lock(&fmutex);
+  while(fitems == 0)
+    cond_wait(&fcond, &fmutex);
+  fitems--;
+  mutex_unlock(&fmutex);
+}
+
+// mutexes and condition variables, on futexes.
+void
+futexes(char *s)
+{
+  enum { NTHREAD = 4 };
+  static int word;
+  int i;
+
+  word = 1;
+  if(futex_wait(&word, 0) != -1){
+    printf("%s: futex_wait on a changed word slept\n", s);
+    exit(1);
+  }
+  if(futex_wake(&word, 1) != 0 || futex_wait((int*)0x1, 0) != -1){
+    printf("%s: bad futex_wake or futex_wait result\n", s);
+    exit(1);
+  }
+
+  mutex_init(&fmutex);
+  cond_init(&fcond);
+  fcount = fitems = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(fworker, 0) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
     }
   }
-
-  if(pid)
-    wait(0);
-  else
-    exit(0);
+  // produce the items one by one.
+  for(i = 0; i < NTHREAD; i++){
+    sleep(1);
+    mutex_lock(&fmutex);
+    fitems++;
+    cond_signal(&fcond);
+    mutex_unlock(&fmutex);
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(fcount != NTHREAD * 1000 || fitems != 0){
+    printf("%s: count %d items %d\n", s, fcount, fitems);
+    exit(1);
+  }
 }
 
+static char * volatile shmthreadaddr;
+static volatile int shmthreaddetach;
 
+static void
+shmthread(void *arg)
+{
+  shmthreaddetach = shmdetach(shmthreadaddr);
+}
+
+// processes see each other's writes to shared memory.
 void
-subdir(char *s)
+sharedmem(char *s)
 {
-  int fd, cc;
+  int id, pid, xstatus;
+  char *a, *b;
 
-  unlink("ff");
-  if(mkdir("dd") != 0){
-    printf("%s: mkdir dd failed\n", s);
+  if((id = shmcreate("shmtest", 2*PGSIZE)) < 0 ||
+     (a = shmattach(id)) == (char*)-1){
+    printf("%s: cannot make a segment\n", s);
     exit(1);
   }
-
-  fd = open("dd/ff", O_CREATE | O_RDWR);
-  if(fd < 0){
-    printf("%s: create dd/ff failed\n", s);
+  if(shmcreate("shmtest", 3*PGSIZE) != -1 || shmcreate("shmtest", 1) != id){
+    printf("%s: bad shmcreate of an existing segment\n", s);
     exit(1);
   }
-  write(fd, "ff", 2);
-  close(fd);
+  a[0] = 'p';
+  a[2*PGSIZE-1] = 'q';
 
-  if(unlink("dd") >= 0){
-    printf("%s: unlink dd (non-empty dir) succeeded!\n", s);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
     exit(1);
   }
-
-  if(mkdir("/dd/dd") != 0){
-    printf("subdir mkdir dd/dd failed\n", s);
+  if(pid == 0){
+    // the child inherits a, and can attach the segment again.
+    if(a[0] != 'p' || (b = shmattach(id)) == (char*)-1 || b == a ||
+       b[2*PGSIZE-1] != 'q')
+      exit(1);
+    b[1] = 'c';
+    if(shmdetach(b) != 0 || shmdetach(b) != -1)
+      exit(2);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed with %d\n", s, xstatus);
     exit(1);
   }
-
-  fd = open("dd/dd/ff", O_CREATE | O_RDWR);
-  if(fd < 0){
-    printf("%s: create dd/dd/ff failed\n", s);
+  if(a[1] != 'c'){
+    printf("%s: child's write not seen\n", s);
     exit(1);
   }
-  write(fd, "FF", 2);
-  close(fd);
-
-  fd = open("dd/dd/../ff", 0);
-  if(fd < 0){
-    printf("%s: open dd/dd/../ff failed\n", s);
+  // a thread's siblings may be using the pages.
+  shmthreadaddr = a;
+  if(thread_create(shmthread, 0) < 0 || thread_join() < 0 ||
+     shmthreaddetach != -1){
+    printf("%s: shmdetach in a thread did not fail\n", s);
     exit(1);
   }
-  cc = read(fd, buf, sizeof(buf));
-  if(cc != 2 || buf[0] != 'f'){
-    printf("%s: dd/dd/../ff wrong content\n", s);
+  if(shmdetach(a) != 0 || shmremove("shmtest") != 0){
+    printf("%s: shmdetach failed\n", s);
     exit(1);
   }
-  close(fd);
+}
 
-  if(link("dd/dd/ff", "dd/dd/ffff") != 0){
-    printf("link dd/dd/ff dd/dd/ffff failed\n", s);
+// a segment lasts from shmcreate() until shmremove() and its
+// last detach, whether or not it is ever attached, and a
+// stale id does not attach whatever later takes its slot.
+void
+shmlifetime(char *s)
+{
+  int i, id, id2;
+  char *a;
+
+  // unattached segments go away at shmremove(), so their
+  // slots can be used over and over.
+  for(i = 0; i < 2*NSHM; i++){
+    if(shmcreate("shmlife", PGSIZE) < 0 || shmremove("shmlife") != 0){
+      printf("%s: create and remove %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  if(shmremove("shmlife") != -1){
+    printf("%s: removed a segment twice\n", s);
     exit(1);
   }
 
-  if(unlink("dd/dd/ff") != 0){
-    printf("%s: unlink dd/dd/ff failed\n", s);
+  // an unattached segment keeps its content.
+  if((id = shmcreate("shmlife", PGSIZE)) < 0 || (a = shmattach(id)) == (char*)-1){
+    printf("%s: cannot make a segment\n", s);
     exit(1);
   }
-  if(open("dd/dd/ff", O_RDONLY) >= 0){
-    printf("%s: open (unlinked) dd/dd/ff succeeded\n", s);
+  a[0] = 'l';
+  if(shmdetach(a) != 0 || (a = shmattach(id)) == (char*)-1 || a[0] != 'l'){
+    printf("%s: segment lost at its last detach\n", s);
     exit(1);
   }
 
-  if(chdir("dd") != 0){
-    printf("%s: chdir dd failed\n", s);
+  // removed while attached: it lasts until the detach, but
+  // the name is free at once.
+  if(shmremove("shmlife") != 0 || shmattach(id) != (char*)-1){
+    printf("%s: attached a removed segment\n", s);
     exit(1);
   }
-  if(chdir("dd/../../dd") != 0){
-    printf("%s: chdir dd/../../dd failed\n", s);
+  a[1] = 'm';
+  if((id2 = shmcreate("shmlife", PGSIZE)) < 0 || id2 == id){
+    printf("%s: name not free after shmremove\n", s);
     exit(1);
   }
-  if(chdir("dd/../../../dd") != 0){
-    printf("chdir dd/../../dd failed\n", s);
+  if(shmdetach(a) != 0){
+    printf("%s: shmdetach failed\n", s);
     exit(1);
   }
-  if(chdir("./..") != 0){
-    printf("%s: chdir ./.. failed\n", s);
+
+  // the old id may name the same slot, but not the new segment.
+  if(shmattach(id) != (char*)-1){
+    printf("%s: stale id attached\n", s);
     exit(1);
   }
+  if((a = shmattach(id2)) == (char*)-1 || a[0] != 0 || shmdetach(a) != 0 ||
+     shmremove("shmlife") != 0){
+    printf("%s: new segment is not fresh\n", s);
+    exit(1);
+  }
+}
 
-  fd = open("dd/dd/ffff", 0);
-  if(fd < 0){
-    printf("%s: open dd/dd/ffff failed\n", s);
+// poll() waits for whichever of several pipes is written to,
+// and reports closed writers and bad fds.
+void
+pollpipes(char *s)
+{
+  struct pollfd fds[3];
+  int a[2], b[2], pid, xstatus, n;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
     exit(1);
   }
-  if(read(fd, buf, sizeof(buf)) != 2){
-    printf("%s: read dd/dd/ffff wrong len\n", s);
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  fds[2].fd = -1;
+  if(poll(fds, 3, 0) != 0 || poll(fds, 3, 2) != 0){
+    printf("%s: empty pipes ready\n", s);
     exit(1);
   }
-  close(fd);
 
-  if(open("dd/dd/ff", O_RDONLY) >= 0){
-    printf("%s: open (unlinked) dd/dd/ff succeeded!\n", s);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
     exit(1);
   }
-
-  if(open("dd/ff/ff", O_CREATE|O_RDWR) >= 0){
-    printf("%s: create dd/ff/ff succeeded!\n", s);
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  n = poll(fds, 3, -1);
+  if(n != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN ||
+     read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: poll returned %d, revents %d %d\n", s, n,
+           fds[0].revents, fds[1].revents);
     exit(1);
   }
-  if(open("dd/xx/ff", O_CREATE|O_RDWR) >= 0){
-    printf("%s: create dd/xx/ff succeeded!\n", s);
+  wait(&xstatus);
+
+  // the write ends are always writable.
+  fds[0].fd = a[1];
+  fds[0].events = POLLOUT;
+  if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLOUT){
+    printf("%s: empty pipe not writable\n", s);
     exit(1);
   }
-  if(open("dd", O_CREATE) >= 0){
-    printf("%s: create dd succeeded!\n", s);
+
+  close(b[1]);
+  if(poll(&fds[1], 1, -1) != 1 || (fds[1].revents & POLLHUP) == 0){
+    printf("%s: no POLLHUP after close\n", s);
     exit(1);
   }
-  if(open("dd", O_RDWR) >= 0){
-    printf("%s: open dd rdwr succeeded!\n", s);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  fds[0].fd = b[0];
+  if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLNVAL){
+    printf("%s: no POLLNVAL for a closed fd\n", s);
     exit(1);
   }
-  if(open("dd", O_WRONLY) >= 0){
-    printf("%s: open dd wronly succeeded!\n", s);
+}
+
+// reads and writes of O_NONBLOCK pipes fail instead of
+// waiting, and fcntl() turns the flag on and off.
+void
+nonblockpipe(char *s)
+{
+  int fds[2], n, tot;
+  char c;
+
+  if(pipe2(fds, O_NONBLOCK) < 0){
+    printf("%s: pipe2 failed\n", s);
     exit(1);
   }
-  if(link("dd/ff/ff", "dd/dd/xx") == 0){
-    printf("%s: link dd/ff/ff dd/dd/xx succeeded!\n", s);
+  if(fcntl(fds[0], F_GETFL, 0) != (O_RDONLY | O_NONBLOCK) ||
+     fcntl(fds[1], F_GETFL, 0) != (O_WRONLY | O_NONBLOCK)){
+    printf("%s: bad F_GETFL\n", s);
     exit(1);
   }
-  if(link("dd/xx/ff", "dd/dd/xx") == 0){
-    printf("%s: link dd/xx/ff dd/dd/xx succeeded!\n", s);
+  if(read(fds[0], &c, 1) != -1){
+    printf("%s: read of an empty pipe did not fail\n", s);
     exit(1);
   }
-  if(link("dd/ff", "dd/dd/ffff") == 0){
-    printf("%s: link dd/ff dd/dd/ffff succeeded!\n", s);
+
+  // fill the pipe: the write that fills it is short.
+  memset(buf, 'n', sizeof(buf));
+  for(tot = 0; (n = write(fds[1], buf, 100)) == 100; tot += n)
+    ;
+  if(n < 0 || write(fds[1], buf, 1) != -1){
+    printf("%s: write to a full pipe did not fail\n", s);
     exit(1);
   }
-  if(mkdir("dd/ff/ff") == 0){
-    printf("%s: mkdir dd/ff/ff succeeded!\n", s);
+  tot += n;
+  for(n = 0; read(fds[0], &c, 1) == 1; n++)
+    ;
+  if(n != tot){
+    printf("%s: wrote %d bytes but read %d\n", s, tot, n);
     exit(1);
   }
-  if(mkdir("dd/xx/ff") == 0){
-    printf("%s: mkdir dd/xx/ff succeeded!\n", s);
+
+  // blocking again, a read of a closed pipe returns 0.
+  if(fcntl(fds[0], F_SETFL, 0) != 0 || fcntl(fds[0], F_GETFL, 0) != O_RDONLY){
+    printf("%s: F_SETFL failed\n", s);
     exit(1);
   }
-  if(mkdir("dd/dd/ffff") == 0){
-    printf("%s: mkdir dd/dd/ffff succeeded!\n", s);
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf("%s: read after close did not return 0\n", s);
     exit(1);
   }
-  if(unlink("dd/xx/ff") == 0){
-    printf("%s: unlink dd/xx/ff succeeded!\n", s);
+  close(fds[0]);
+  if(pipe2(fds, O_CREATE) != -1 || fcntl(fds[0], F_GETFL, 0) != -1){
+    printf("%s: bad pipe2 flags or fd accepted\n", s);
     exit(1);
   }
-  if(unlink("dd/ff/ff") == 0){
-    printf("%s: unlink dd/ff/ff succeeded!\n", s);
+}
+
+// gather and scatter with writev/readv, and read and write at
+// explicit offsets with pread/pwrite.
+void
+vectorio(char *s)
+{
+  struct iovec iov[3];
+  char hdr[8], tail[3];
+  int fd, fds[2], i, n;
+
+  unlink("vectorio");
+  fd = open("vectorio", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create vectorio\n", s);
     exit(1);
   }
-  if(chdir("dd/ff") == 0){
-    printf("%s: chdir dd/ff succeeded!\n", s);
+  memset(hdr, 'h', sizeof(hdr));
+  memset(buf, 'p', BSIZE);
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = 0;
+  iov[1].iov_len = 0;
+  iov[2].iov_base = buf;
+  iov[2].iov_len = BSIZE;
+  if(writev(fd, iov, 3) != sizeof(hdr) + BSIZE){
+    printf("%s: writev failed\n", s);
     exit(1);
   }
-  if(chdir("dd/xx") == 0){
-    printf("%s: chdir dd/xx succeeded!\n", s);
+  if(pwrite(fd, "xyz", 3, 4) != 3){
+    printf("%s: pwrite failed\n", s);
     exit(1);
   }
+  close(fd);
 
-  if(unlink("dd/dd/ffff") != 0){
-    printf("%s: unlink dd/dd/ff failed\n", s);
+  fd = open("vectorio", O_RDONLY);
+  memset(buf, 0, BSIZE);
+  if(pread(fd, tail, 3, sizeof(hdr) + BSIZE - 3) != 3 ||
+     tail[0] != 'p' || tail[2] != 'p'){
+    printf("%s: pread failed\n", s);
     exit(1);
   }
-  if(unlink("dd/ff") != 0){
-    printf("%s: unlink dd/ff failed\n", s);
+  // pread must not have moved the file offset.
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = buf;
+  iov[1].iov_len = BSIZE + 10;
+  n = readv(fd, iov, 2);
+  close(fd);
+  if(n != sizeof(hdr) + BSIZE){
+    printf("%s: readv returned %d\n", s, n);
     exit(1);
   }
-  if(unlink("dd") == 0){
-    printf("%s: unlink non-empty dd succeeded!\n", s);
-    exit(1);
+  for(i = 0; i < sizeof(hdr); i++){
+    if(hdr[i] != (i >= 4 && i < 7 ? "xyz"[i-4] : 'h')){
+      printf("%s: wrong header byte %d\n", s, i);
+      exit(1);
+    }
   }
-  if(unlink("dd/dd") < 0){
-    printf("%s: unlink dd/dd failed\n", s);
+  for(i = 0; i < BSIZE; i++){
+    if(buf[i] != 'p'){
+      printf("%s: wrong payload byte %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // pread on a pipe has no offset to read at.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
     exit(1);
   }
-  if(unlink("dd") < 0){
-    printf("%s: unlink dd failed\n", s);
+  if(pread(fds[0], buf, 1, 0) != -1){
+    printf("%s: pread on a pipe succeeded\n", s);
     exit(1);
   }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("vectorio");
 }
 
-// test writes that are larger than the log.
+// read back file data that is still waiting for disk blocks
+// (delayed allocation), across O_TRUNC and after close.
 void
-bigwrite(char *s)
+delaywrite(char *s)
 {
-  int fd, sz;
+  int fd, fd1, i, n;
+  char c;
 
-  unlink("bigwrite");
-  for(sz = 499; sz < (MAXOPBLOCKS+2)*BSIZE; sz += 471){
-    fd = open("bigwrite", O_CREATE | O_RDWR);
-    if(fd < 0){
-      printf("%s: cannot create bigwrite\n", s);
+  unlink("delaywrite");
+  fd = open("delaywrite", O_CREATE | O_RDWR);
+  fd1 = open("delaywrite", O_RDONLY);
+  if(fd < 0 || fd1 < 0){
+    printf("%s: cannot create delaywrite\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write %d failed\n", s, i);
       exit(1);
     }
-    int i;
-    for(i = 0; i < 2; i++){
-      int cc = write(fd, buf, sz);
-      if(cc != sz){
-        printf("%s: write(%d) ret %d\n", s, sz, cc);
-        exit(1);
-      }
+  }
+  for(i = 0; i < 20; i++){
+    if(read(fd1, buf, BSIZE) != BSIZE || buf[0] != 'a' + i || buf[BSIZE-1] != 'a' + i){
+      printf("%s: read %d before close failed\n", s, i);
+      exit(1);
     }
-    close(fd);
-    unlink("bigwrite");
   }
+  close(fd);
+  close(fd1);
+
+  // O_TRUNC must throw away delayed blocks, too.
+  fd = open("delaywrite", O_RDWR);
+  for(i = 0; i < 20; i++)
+    read(fd, buf, BSIZE);
+  if(write(fd, buf, 5*BSIZE) != 5*BSIZE){
+    printf("%s: append failed\n", s);
+    exit(1);
+  }
+  fd1 = open("delaywrite", O_RDWR | O_TRUNC);
+  if(write(fd1, "yz", 2) != 2){
+    printf("%s: write after O_TRUNC failed\n", s);
+    exit(1);
+  }
+  close(fd1);
+  close(fd);
+
+  fd = open("delaywrite", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  if(n != 2 || buf[0] != 'y' || buf[1] != 'z'){
+    printf("%s: read after O_TRUNC got %d bytes\n", s, n);
+    exit(1);
+  }
+  if(read(fd, &c, 1) != 0){
+    printf("%s: file too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("delaywrite");
 }
 
 
@@ -2592,6 +3730,10 @@ struct test {
   {writebig, "writebig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
+  {hashdir, "hashdir"},
+  {namecache, "namecache"},
+  {mountfs, "mountfs"},
+  {tmpfsfile, "tmpfsfile"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
@@ -2612,6 +3754,20 @@ struct test {
   {linkunlink, "linkunlink"},
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
+  {delaywrite, "delaywrite"},
+  {inlinefile, "inlinefile"},
+  {bigtxwrite, "bigtxwrite"},
+  {vectorio, "vectorio"},
+  {relaxedlog, "relaxedlog"},
+  {lockstats, "lockstats"},
+  {sharedread, "sharedread"},
+  {threads, "threads"},
+  {threadshrink, "threadshrink"},
+  {futexes, "futexes"},
+  {sharedmem, "sharedmem"},
+  {shmlifetime, "shmlifetime"},
+  {pollpipes, "pollpipes"},
+  {nonblockpipe, "nonblockpipe"},
   {bigfile, "bigfile"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
@@ -2924,6 +4080,73 @@ outofinodes(char *s)
   }
 }
 
+// an append that cannot move an inline file's content out
+// to a block, because the disk is full, leaves the content.
+void
+inlinefull(char *s)
+{
+  int fd, fi, i, n, done;
+  char name[8];
+
+  unlink("inlinefull");
+  fd = open("inlinefull", O_CREATE | O_RDWR);
+  memset(buf, 'i', 50);
+  if(fd < 0 || write(fd, buf, 50) != 50){
+    printf("%s: cannot create inlinefull\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  done = 0;
+  for(fi = 0; done == 0 && fi < 10; fi++){
+    name[0] = 'b';
+    name[1] = 'i';
+    name[2] = 'g';
+    name[3] = '0' + fi;
+    name[4] = '\0';
+    unlink(name);
+    if((fd = open(name, O_CREATE | O_RDWR | O_TRUNC)) < 0)
+      break;
+    for(i = 0; i < MAXFILE; i++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        done = 1;
+        break;
+      }
+    }
+    close(fd);
+  }
+
+  fd = open("inlinefull", O_RDWR);
+  memset(buf, 'x', BSIZE);
+  n = write(fd, buf, BSIZE);
+  close(fd);
+  if(n > 0){
+    printf("%s: append to a full disk wrote %d bytes\n", s, n);
+    exit(1);
+  }
+  fd = open("inlinefull", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  for(i = 0; i < n; i++){
+    if(buf[i] != 'i')
+      break;
+  }
+  if(n != 50 || i != n){
+    printf("%s: content lost: read %d bytes, %d of them right\n", s, n, i);
+    exit(1);
+  }
+
+  for(i = 0; i < fi; i++){
+    name[0] = 'b';
+    name[1] = 'i';
+    name[2] = 'g';
+    name[3] = '0' + i;
+    name[4] = '\0';
+    unlink(name);
+  }
+  unlink("inlinefull");
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +4154,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {inlinefull, "inlinefull"},
     
   { 0, 0},
 };
@@ -41,4 +41,26 @@ entry("set_priority");
 entry("sigreturn");
 entry("sigalarm");
 entry("trace");
-entry("settickets");
\ No newline at end of file
+entry("settickets");
+entry("logstat");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("fsync");
+entry("fdatasync");
+entry("logmode");
+entry("mount");
+entry("umount");
+entry("lockstat");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("shmcreate");
+entry("shmattach");
+entry("shmdetach");
+entry("poll");
+entry("fcntl");
+entry("pipe2");
+entry("shmremove");
\ No newline at end of file